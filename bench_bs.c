@@ -0,0 +1,573 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ Micro-benchmarks for the bs.h primitives.
+
+ Each benchmark runs for at least the given time (-t seconds, default 0.2) and reports
+ ns per call and Mbit/s of bitstream consumed or produced, as JSON on stdout or to -o file.
+ Synthetic inputs are always used; every .264 file given on the command line is split
+ into NALs and converted to RBSP, and the concatenated RBSPs are used as a second input.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bs.h"
+#include "h264_stream.h"
+
+#define SYNTHETIC_SIZE 1024*1024
+#define NUM_VALUES 65536
+
+typedef struct
+{
+    const char* name;
+    const char* input;
+    int width;          // field width in bits, 0 for variable length fields
+    double ops;
+    double bits;
+    double seconds;
+} result_t;
+
+static result_t results[256];
+static int num_results = 0;
+static double min_seconds = 0.2;
+
+// keeps the compiler from dropping the values read
+static volatile uint32_t sink;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void add_result(const char* name, const char* input, int width, double ops, double bits, double seconds)
+{
+    if (num_results >= (int)(sizeof(results) / sizeof(results[0]))) { return; }
+    result_t* r = &results[num_results++];
+    r->name = name;
+    r->input = input;
+    r->width = width;
+    r->ops = ops;
+    r->bits = bits;
+    r->seconds = seconds;
+}
+
+// values with the distribution typical of header fields: mostly small, occasionally large
+static void make_values(uint32_t* values, int n, int is_signed)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        int r = rand() % 100;
+        uint32_t v;
+        if (r < 60) { v = rand() % 4; }
+        else if (r < 90) { v = rand() % 64; }
+        else if (r < 99) { v = rand() % 4096; }
+        else { v = rand() % 1000000; }
+        if (is_signed && (rand() & 1)) { v = (uint32_t)(-(int32_t)v); }
+        values[i] = v;
+    }
+}
+
+static void bench_read_u(const char* input, uint8_t* buf, int size, int width)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    int per_pass = (size * 8) / width;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < per_pass; i++) { sum += bs_read_u(&b, width); }
+        ops += per_pass;
+        bits += (double)per_pass * width;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("bs_read_u", input, width, ops, bits, t);
+}
+
+static void bench_read_u1(const char* input, uint8_t* buf, int size)
+{
+    bs_t b;
+    double ops = 0;
+    uint32_t sum = 0;
+    int per_pass = size * 8;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < per_pass; i++) { sum += bs_read_u1(&b); }
+        ops += per_pass;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("bs_read_u1", input, 1, ops, ops, t);
+}
+
+static void bench_read_u8(const char* input, uint8_t* buf, int size)
+{
+    bs_t b;
+    double ops = 0;
+    uint32_t sum = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < size; i++) { sum += bs_read_u8(&b); }
+        ops += size;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("bs_read_u8", input, 8, ops, ops * 8, t);
+}
+
+// reads codes until the end of the buffer; on arbitrary data this sees the code lengths the data happens to contain
+static void bench_read_ue(const char* name, const char* input, uint8_t* buf, int size, int is_signed)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int n = 0;
+        bs_init(&b, buf, size);
+        while (!bs_eof(&b))
+        {
+            if (is_signed) { sum += bs_read_se(&b); }
+            else { sum += bs_read_ue(&b); }
+            n++;
+        }
+        ops += n;
+        bits += (double)size * 8;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result(name, input, 0, ops, bits, t);
+}
+
+static void bench_read_ue_array(const char* name, uint8_t* buf, int size, int num_values, int is_signed)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    int* values = (int*)malloc(num_values * sizeof(int));
+    double t0 = now(), t;
+
+    do
+    {
+        bs_init(&b, buf, size);
+        if (is_signed) { bs_read_se_array(&b, values, num_values); }
+        else { bs_read_ue_array(&b, values, num_values); }
+        ops += num_values;
+        bits += (double)size * 8;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = values[num_values - 1];
+    free(values);
+    add_result(name, "synthetic", 0, ops, bits, t);
+}
+
+static void bench_next_bits(const char* input, uint8_t* buf, int size, int width)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    int per_pass = (size * 8) / width - 1;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < per_pass; i++)
+        {
+            sum += bs_next_bits(&b, width);
+            bs_skip_u(&b, width);
+        }
+        ops += per_pass;
+        bits += (double)per_pass * width;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("bs_next_bits", input, width, ops, bits, t);
+}
+
+static void bench_write_u(uint8_t* buf, int size, int width)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    int per_pass = (size * 8) / width;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < per_pass; i++) { bs_write_u(&b, width, i * 0x9E3779B1); }
+        bs_write_flush(&b);
+        ops += per_pass;
+        bits += (double)per_pass * width;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = buf[size / 2];
+    add_result("bs_write_u", "synthetic", width, ops, bits, t);
+}
+
+static void bench_write_u1(uint8_t* buf, int size)
+{
+    bs_t b;
+    double ops = 0;
+    int per_pass = size * 8;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < per_pass; i++) { bs_write_u1(&b, (i >> 3) ^ i); }
+        bs_write_flush(&b);
+        ops += per_pass;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = buf[size / 2];
+    add_result("bs_write_u1", "synthetic", 1, ops, ops, t);
+}
+
+static void bench_write_ue(const char* name, uint8_t* buf, int size, uint32_t* values, int num_values, int is_signed)
+{
+    bs_t b;
+    double ops = 0, bits = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        bs_init(&b, buf, size);
+        for (i = 0; i < num_values; i++)
+        {
+            if (is_signed) { bs_write_se(&b, (int32_t)values[i]); }
+            else { bs_write_ue(&b, values[i]); }
+        }
+        bits += (double)(b.p - b.start) * 8 + (8 - b.bits_left);
+        bs_write_flush(&b);
+        ops += num_values;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = buf[0];
+    add_result(name, "synthetic", 0, ops, bits, t);
+}
+
+// splits the whole buffer into NALs; bits are those of the buffer scanned
+static void bench_find_nal_unit(const char* input, uint8_t* buf, int size)
+{
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        uint8_t* p = buf;
+        int sz = size;
+        int nal_start, nal_end;
+        while (find_nal_unit(p, sz, &nal_start, &nal_end) > 0)
+        {
+            sum += nal_end - nal_start;
+            p += nal_end;
+            sz -= nal_end;
+            ops++;
+        }
+        ops++; // the last call, which found no complete NAL
+        bits += (double)size * 8;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("find_nal_unit", input, 0, ops, bits, t);
+}
+
+// bits are those of the NALs converted
+static void bench_nal_to_rbsp(const char* input, uint8_t** nals, int* sizes, int num_nals, uint8_t* rbsp)
+{
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        for (i = 0; i < num_nals; i++)
+        {
+            int nal_size = sizes[i];
+            int rbsp_size = sizes[i];
+            sum += nal_to_rbsp(nals[i], &nal_size, rbsp, &rbsp_size);
+            bits += (double)sizes[i] * 8;
+        }
+        ops += num_nals;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("nal_to_rbsp", input, 0, ops, bits, t);
+}
+
+// the NALs are used as RBSPs, which is what they look like apart from the few emulation prevention bytes
+static void bench_rbsp_to_nal(const char* input, uint8_t** nals, int* sizes, int num_nals, uint8_t* nal_buf)
+{
+    double ops = 0, bits = 0;
+    uint32_t sum = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        for (i = 0; i < num_nals; i++)
+        {
+            int nal_size = rbsp_to_nal_size(nals[i], sizes[i]);
+            sum += rbsp_to_nal(nals[i], &sizes[i], nal_buf, &nal_size);
+            bits += (double)sizes[i] * 8;
+        }
+        ops += num_nals;
+    } while ((t = now() - t0) < min_seconds);
+
+    sink = sum;
+    add_result("rbsp_to_nal", input, 0, ops, bits, t);
+}
+
+static void bench_read_nal_units(const char* input, uint8_t** nals, int* sizes, int num_nals)
+{
+    h264_stream_t* h = h264_new();
+    double ops = 0, bits = 0;
+    double t0 = now(), t;
+
+    do
+    {
+        int i;
+        for (i = 0; i < num_nals; i++)
+        {
+            read_nal_unit(h, nals[i], sizes[i]);
+            bits += (double)sizes[i] * 8;
+        }
+        ops += num_nals;
+    } while ((t = now() - t0) < min_seconds);
+
+    h264_free(h);
+    add_result("read_nal_unit", input, 0, ops, bits, t);
+}
+
+static uint8_t* read_file(const char* filename, int* size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { fprintf( stderr, "!! Error: could not open file %s: %s \n", filename, strerror(errno)); return NULL; }
+
+    int cap = 1024*1024;
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    size_t rsz;
+    *size = 0;
+    while ((rsz = fread(buf + *size, 1, cap - *size, f)) > 0)
+    {
+        *size += rsz;
+        if (*size == cap) { cap *= 2; buf = (uint8_t*)realloc(buf, cap); }
+    }
+    fclose(f);
+    return buf;
+}
+
+static void print_results(FILE* out)
+{
+    int i;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"optimize_bs\": %d,\n", _OPTIMIZE_BS_);
+    fprintf(out, "  \"min_seconds\": %g,\n", min_seconds);
+    fprintf(out, "  \"results\": [\n");
+    for (i = 0; i < num_results; i++)
+    {
+        result_t* r = &results[i];
+        fprintf(out, "    { \"name\": \"%s\", \"input\": \"%s\", \"width\": %d, \"ops\": %.0f, \"bits\": %.0f, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"mbit_per_s\": %.2f }%s\n",
+                r->name, r->input, r->width, r->ops, r->bits, r->seconds,
+                r->seconds * 1e9 / r->ops,
+                r->bits / r->seconds / 1e6,
+                (i < num_results - 1) ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+static void usage()
+{
+    fprintf( stderr, "bench_bs - micro-benchmarks for the bs.h bit reader and writer\n");
+    fprintf( stderr, "Usage: \n");
+    fprintf( stderr, "bench_bs [-t seconds] [-o output.json] [input1.264 ...]\n");
+    fprintf( stderr, "\t-t minimum run time of each benchmark in seconds, default 0.2\n");
+    fprintf( stderr, "\t-o write JSON results to a file instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const int widths[] = { 1, 3, 5, 8, 12, 16, 24, 32 };
+    static const int next_widths[] = { 1, 8, 16, 24, 32 };
+    FILE* out = stdout;
+    int i, j;
+
+    // synthetic inputs: random bits, and ue / se codes of typical header values
+    uint8_t* random_buf = (uint8_t*)malloc(SYNTHETIC_SIZE);
+    uint8_t* ue_buf = (uint8_t*)calloc(1, SYNTHETIC_SIZE);
+    uint8_t* se_buf = (uint8_t*)calloc(1, SYNTHETIC_SIZE);
+    uint8_t* write_buf = (uint8_t*)calloc(1, SYNTHETIC_SIZE);
+    uint32_t* ue_values = (uint32_t*)malloc(NUM_VALUES * sizeof(uint32_t));
+    uint32_t* se_values = (uint32_t*)malloc(NUM_VALUES * sizeof(uint32_t));
+    int ue_size, se_size;
+    bs_t b;
+
+    srand(1);
+    for (i = 0; i < SYNTHETIC_SIZE; i++) { random_buf[i] = rand(); }
+    make_values(ue_values, NUM_VALUES, 0);
+    make_values(se_values, NUM_VALUES, 1);
+
+    bs_init(&b, ue_buf, SYNTHETIC_SIZE);
+    for (i = 0; i < NUM_VALUES; i++) { bs_write_ue(&b, ue_values[i]); }
+    ue_size = bs_write_finalize(&b);
+
+    bs_init(&b, se_buf, SYNTHETIC_SIZE);
+    for (i = 0; i < NUM_VALUES; i++) { bs_write_se(&b, (int32_t)se_values[i]); }
+    se_size = bs_write_finalize(&b);
+
+    // sample inputs: the RBSPs of all NALs of all files, concatenated
+    uint8_t* rbsp = NULL;
+    int rbsp_size = 0;
+    uint8_t** nals = NULL;
+    int* nal_sizes = NULL;
+    int num_nals = 0;
+    uint8_t* annexb = NULL;
+    int annexb_size = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) { min_seconds = atof(argv[++i]); continue; }
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out = fopen(argv[++i], "wt");
+            if (out == NULL) { fprintf( stderr, "!! Error: could not open file %s: %s \n", argv[i], strerror(errno)); return EXIT_FAILURE; }
+            continue;
+        }
+        if (argv[i][0] == '-') { usage(); return EXIT_FAILURE; }
+
+        int size;
+        uint8_t* buf = read_file(argv[i], &size);
+        if (buf == NULL) { return EXIT_FAILURE; }
+
+        annexb = (uint8_t*)realloc(annexb, annexb_size + size);
+        memcpy(annexb + annexb_size, buf, size);
+        annexb_size += size;
+
+        uint8_t* p = buf;
+        int nal_start, nal_end;
+        while (find_nal_unit(p, size, &nal_start, &nal_end) > 0)
+        {
+            int nal_size = nal_end - nal_start;
+            int out_size = nal_size;
+
+            nals = (uint8_t**)realloc(nals, (num_nals + 1) * sizeof(uint8_t*));
+            nal_sizes = (int*)realloc(nal_sizes, (num_nals + 1) * sizeof(int));
+            nals[num_nals] = (uint8_t*)malloc(nal_size);
+            memcpy(nals[num_nals], p + nal_start, nal_size);
+            nal_sizes[num_nals] = nal_size;
+            num_nals++;
+
+            rbsp = (uint8_t*)realloc(rbsp, rbsp_size + nal_size);
+            if (nal_to_rbsp(p + nal_start, &nal_size, rbsp + rbsp_size, &out_size) >= 0) { rbsp_size += out_size; }
+
+            p += nal_end;
+            size -= nal_end;
+        }
+        free(buf);
+    }
+
+    for (j = 0; j < (int)(sizeof(widths) / sizeof(widths[0])); j++)
+    {
+        bench_read_u("synthetic", random_buf, SYNTHETIC_SIZE, widths[j]);
+        if (rbsp_size > 0) { bench_read_u("samples", rbsp, rbsp_size, widths[j]); }
+    }
+    bench_read_u1("synthetic", random_buf, SYNTHETIC_SIZE);
+    bench_read_u8("synthetic", random_buf, SYNTHETIC_SIZE);
+    if (rbsp_size > 0) { bench_read_u8("samples", rbsp, rbsp_size); }
+
+    bench_read_ue("bs_read_ue", "synthetic", ue_buf, ue_size, 0);
+    bench_read_ue("bs_read_se", "synthetic", se_buf, se_size, 1);
+    if (rbsp_size > 0) { bench_read_ue("bs_read_ue", "samples", rbsp, rbsp_size, 0); }
+    bench_read_ue_array("bs_read_ue_array", ue_buf, ue_size, NUM_VALUES, 0);
+    bench_read_ue_array("bs_read_se_array", se_buf, se_size, NUM_VALUES, 1);
+
+    for (j = 0; j < (int)(sizeof(next_widths) / sizeof(next_widths[0])); j++)
+    {
+        bench_next_bits("synthetic", random_buf, SYNTHETIC_SIZE, next_widths[j]);
+    }
+
+    for (j = 0; j < (int)(sizeof(widths) / sizeof(widths[0])); j++)
+    {
+        bench_write_u(write_buf, SYNTHETIC_SIZE, widths[j]);
+    }
+    bench_write_u1(write_buf, SYNTHETIC_SIZE);
+    bench_write_ue("bs_write_ue", write_buf, SYNTHETIC_SIZE, ue_values, NUM_VALUES, 0);
+    bench_write_ue("bs_write_se", write_buf, SYNTHETIC_SIZE, se_values, NUM_VALUES, 1);
+
+    // random bytes hold a start code every 16 MB or so, so this is mostly the raw scanning speed
+    bench_find_nal_unit("synthetic", random_buf, SYNTHETIC_SIZE);
+    if (annexb_size > 0) { bench_find_nal_unit("samples", annexb, annexb_size); }
+
+    if (num_nals > 0) { bench_nal_to_rbsp("samples", nals, nal_sizes, num_nals, rbsp); }
+    if (num_nals > 0)
+    {
+        uint8_t* nal_buf = (uint8_t*)malloc(annexb_size * 3 / 2 + 1);
+        bench_rbsp_to_nal("samples", nals, nal_sizes, num_nals, nal_buf);
+        free(nal_buf);
+    }
+    if (num_nals > 0) { bench_read_nal_units("samples", nals, nal_sizes, num_nals); }
+
+    print_results(out);
+    if (out != stdout) { fclose(out); }
+
+    for (i = 0; i < num_nals; i++) { free(nals[i]); }
+    free(nals);
+    free(nal_sizes);
+    free(rbsp);
+    free(annexb);
+    free(random_buf);
+    free(ue_buf);
+    free(se_buf);
+    free(write_buf);
+    free(ue_values);
+    free(se_values);
+
+    return 0;
+}
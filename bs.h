@@ -24,6 +24,7 @@
 #define _H264_BS_H        1
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -37,33 +38,70 @@ typedef struct
 	uint8_t* p;
 	uint8_t* end;
 	int bits_left;
+	uint64_t cache;     // big-endian copy of the 8 bytes starting at cache_p
+	uint8_t* cache_p;
+	int cache_bits;     // number of bits in cache which lie before end
+	int padding;        // number of zero bytes after end which may be read, see bs_init_padded
+	uint64_t acc;       // bits written but not yet stored, starting at the top bit of *acc_p
+	uint8_t* acc_p;     // NULL when nothing is pending
+	int acc_bits;
+	int error;          // set when a read runs out of data, stays set until the next bs_init
+	uint8_t* stop_p;    // byte holding the last 1 bit before end, NULL until bs_find_stop_bit
+	int stop_bits_left; // value of bits_left when that bit is the next one
+	uint8_t* src_p;     // escaped NAL bytes not yet copied to end, see bs_init_nal; NULL otherwise
+	uint8_t* src_end;
 } bs_t;
 
+// number of zero bytes a buffer passed to bs_init_padded must have after its end
+#define BS_PADDING 8
+
 #define _OPTIMIZE_BS_ 1
 
 #if ( _OPTIMIZE_BS_ > 0 )
 #ifndef FAST_U8
 #define FAST_U8
 #endif
+#ifndef FAST_READ_CACHE
+#define FAST_READ_CACHE
+#endif
+#ifndef FAST_WRITE_ACCUM
+#define FAST_WRITE_ACCUM
+#endif
 #endif
 
 
 static bs_t* bs_new(uint8_t* buf, size_t size);
+static bs_t* bs_new_padded(uint8_t* buf, size_t size);
 static void bs_free(bs_t* b);
 static bs_t* bs_clone( bs_t* dest, const bs_t* src );
 static bs_t*  bs_init(bs_t* b, uint8_t* buf, size_t size);
+static bs_t*  bs_init_padded(bs_t* b, uint8_t* buf, size_t size);
+static bs_t*  bs_init_nal(bs_t* b, uint8_t* buf, uint8_t* nal, size_t nal_size);
+static bs_t* bs_new_nal(uint8_t* buf, uint8_t* nal, size_t nal_size);
+static void bs_unescape(bs_t* b, ptrdiff_t n);
+static void bs_unescape_all(bs_t* b);
 static uint32_t bs_byte_aligned(bs_t* b);
 static int bs_eof(bs_t* b);
 static int bs_overrun(bs_t* b);
 static int bs_pos(bs_t* b);
+static int64_t bs_pos64(bs_t* b);
+static int64_t bs_bytes_left64(bs_t* b);
+static int bs_error(bs_t* b);
+static int bs_before_stop_bit(bs_t* b);
 
 static uint32_t bs_peek_u1(bs_t* b);
 static uint32_t bs_read_u1(bs_t* b);
 static uint32_t bs_read_u(bs_t* b, int n);
 static uint32_t bs_read_f(bs_t* b, int n);
+static uint32_t bs_read_un(bs_t* b, int n);
 static uint32_t bs_read_u8(bs_t* b);
 static uint32_t bs_read_ue(bs_t* b);
 static int32_t  bs_read_se(bs_t* b);
+static void bs_read_ue_array(bs_t* b, int* buf, int n);
+static void bs_read_se_array(bs_t* b, int* buf, int n);
+static void bs_skip_u(bs_t* b, int n);
+static void bs_skip_ue(bs_t* b);
+static void bs_skip_se(bs_t* b);
 
 static void bs_write_u1(bs_t* b, uint32_t v);
 static void bs_write_u(bs_t* b, int n, uint32_t v);
@@ -71,10 +109,13 @@ static void bs_write_f(bs_t* b, int n, uint32_t v);
 static void bs_write_u8(bs_t* b, uint32_t v);
 static void bs_write_ue(bs_t* b, uint32_t v);
 static void bs_write_se(bs_t* b, int32_t v);
+static void bs_write_flush(bs_t* b);
+static int bs_write_finalize(bs_t* b);
 
 static int bs_read_bytes(bs_t* b, uint8_t* buf, int len);
 static int bs_write_bytes(bs_t* b, uint8_t* buf, int len);
 static int bs_skip_bytes(bs_t* b, int len);
+static int bs_skip_run(bs_t* b, uint8_t v);
 static uint32_t bs_next_bits(bs_t* b, int nbits);
 // IMPLEMENTATION
 
@@ -84,6 +125,18 @@ static inline bs_t* bs_init(bs_t* b, uint8_t* buf, size_t size)
     b->p = buf;
     b->end = buf + size;
     b->bits_left = 8;
+    b->cache = 0;
+    b->cache_p = buf;
+    b->cache_bits = 0;
+    b->padding = 0;
+    b->acc = 0;
+    b->acc_p = NULL;
+    b->acc_bits = 0;
+    b->error = 0;
+    b->stop_p = NULL;
+    b->stop_bits_left = 0;
+    b->src_p = NULL;
+    b->src_end = NULL;
     return b;
 }
 
@@ -94,6 +147,46 @@ static inline bs_t* bs_new(uint8_t* buf, size_t size)
     return b;
 }
 
+/**
+ Like bs_init, for a buffer which is followed by at least BS_PADDING bytes of zeros.
+ The cache is then refilled with whole-word loads right up to the end of the data.
+ */
+static inline bs_t* bs_init_padded(bs_t* b, uint8_t* buf, size_t size)
+{
+    bs_init(b, buf, size);
+    b->padding = BS_PADDING;
+    return b;
+}
+
+static inline bs_t* bs_new_padded(uint8_t* buf, size_t size)
+{
+    bs_t* b = (bs_t*)malloc(sizeof(bs_t));
+    bs_init_padded(b, buf, size);
+    return b;
+}
+
+/**
+ Like bs_init_padded, for reading the RBSP of a NAL without converting all of it up front.
+ Emulation prevention bytes are removed as reads reach the data, a few dozen bytes at a time, so parsing
+ a header copies only the header.  buf must have room for nal_size + BS_PADDING bytes; it need not be zeroed.
+ Positions are RBSP positions, as if nal_to_rbsp had been run on the whole NAL.
+ */
+static inline bs_t* bs_init_nal(bs_t* b, uint8_t* buf, uint8_t* nal, size_t nal_size)
+{
+    bs_init_padded(b, buf, 0);
+    memset(buf, 0, BS_PADDING);
+    b->src_p = nal;
+    b->src_end = nal + nal_size;
+    return b;
+}
+
+static inline bs_t* bs_new_nal(uint8_t* buf, uint8_t* nal, size_t nal_size)
+{
+    bs_t* b = (bs_t*)malloc(sizeof(bs_t));
+    bs_init_nal(b, buf, nal, nal_size);
+    return b;
+}
+
 static inline void bs_free(bs_t* b)
 {
     free(b);
@@ -105,6 +198,18 @@ static inline bs_t* bs_clone(bs_t* dest, const bs_t* src)
     dest->p = src->p;
     dest->end = src->end;
     dest->bits_left = src->bits_left;
+    dest->cache = src->cache;
+    dest->cache_p = src->cache_p;
+    dest->cache_bits = src->cache_bits;
+    dest->padding = src->padding;
+    dest->acc = src->acc;
+    dest->acc_p = src->acc_p;
+    dest->acc_bits = src->acc_bits;
+    dest->error = src->error;
+    dest->stop_p = src->stop_p;
+    dest->stop_bits_left = src->stop_bits_left;
+    dest->src_p = src->src_p;
+    dest->src_end = src->src_end;
     return dest;
 }
 
@@ -113,7 +218,51 @@ static inline uint32_t bs_byte_aligned(bs_t* b)
     return (b->bits_left == 8);
 }
 
-static inline int bs_eof(bs_t* b) { if (b->p >= b->end) { return 1; } else { return 0; } }
+/**
+ Copy escaped NAL bytes to the end of the buffer, dropping emulation prevention bytes, until at least n bytes
+ follow the current one or the NAL runs out.  Only stops after a nonzero byte (or an emulation prevention byte),
+ so the rest of the NAL can be converted on its own.  A forbidden 00 00 00/01/02 sets the error flag and ends
+ the data there; a final 00 00 03 (cabac_zero_word) loses its 03, as in nal_to_rbsp.
+ */
+static inline void bs_unescape(bs_t* b, ptrdiff_t n)
+{
+    uint8_t* q = b->end;
+    uint8_t* s = b->src_p;
+    int count = 0;
+
+    if (n < 64) { n = 64; }
+
+    while (s < b->src_end && (q - b->p < n || count != 0))
+    {
+        if (count == 2 && *s <= 0x03)
+        {
+            if (*s < 0x03 || (s + 1 < b->src_end && s[1] > 0x03)) { b->error = 1; b->src_end = s; break; }
+            if (s + 1 == b->src_end) { b->src_end = s; break; } // cabac_zero_word
+            s++;
+            count = 0;
+        }
+        count = (*s == 0) ? count + 1 : 0;
+        *q++ = *s++;
+    }
+
+    memset(q, 0, BS_PADDING);
+    b->end = q;
+    b->src_p = s;
+}
+
+// copy all of the rest of the NAL, see bs_unescape
+static inline void bs_unescape_all(bs_t* b)
+{
+    if (b->src_p < b->src_end) { bs_unescape(b, (b->end - b->p) + (b->src_end - b->src_p)); }
+}
+
+// make sure the n bytes from the current one are in the buffer, if the NAL has them
+static inline void bs_need(bs_t* b, ptrdiff_t n)
+{
+    if (b->src_p < b->src_end && b->end - b->p < n) { bs_unescape(b, n); }
+}
+
+static inline int bs_eof(bs_t* b) { bs_need(b, 1); if (b->p >= b->end) { return 1; } else { return 0; } }
 
 static inline int bs_overrun(bs_t* b) { if (b->p > b->end) { return 1; } else { return 0; } }
 
@@ -121,18 +270,144 @@ static inline int bs_pos(bs_t* b) { if (b->p > b->end) { return (b->end - b->sta
 
 static inline int bs_bytes_left(bs_t* b) { return (b->end - b->p); }
 
+// as bs_pos and bs_bytes_left, for buffers of 2 GB or more
+static inline int64_t bs_pos64(bs_t* b) { if (b->p > b->end) { return (int64_t)(b->end - b->start); } else { return (int64_t)(b->p - b->start); } }
+
+static inline int64_t bs_bytes_left64(bs_t* b) { return (int64_t)(b->end - b->p); }
+
+/**
+ Nonzero once any read has asked for more bits than the buffer holds; the missing bits read as 0.
+ Parsers check this to stop loops early on truncated or corrupt data, rather than spinning over zeros.
+ */
+static inline int bs_error(bs_t* b) { return b->error; }
+
+static inline uint64_t bs_load_be64(const uint8_t* p)
+{
+    // compilers turn this into a single load and byte swap
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] <<  8) |  (uint64_t)p[7];
+}
+
+// reload the cache with the 8 bytes starting at the current byte; bytes past the end read as 0
+static inline void bs_refill(bs_t* b)
+{
+    bs_need(b, 8);
+    b->cache_p = b->p;
+    if (b->end - b->p >= 8 - b->padding) // all 8 bytes are readable, before the end or in the zero padding
+    {
+        ptrdiff_t len = b->end - b->p;
+        b->cache = bs_load_be64(b->p);
+        b->cache_bits = (len >= 8) ? 64 : (len > 0) ? (int)len * 8 : 0;
+    }
+    else
+    {
+        int i;
+        int len = (b->p < b->end) ? (int)(b->end - b->p) : 0;
+        b->cache = 0;
+        for (i = 0; i < len; i++)
+        {
+            b->cache |= (uint64_t)b->p[i] << (56 - 8*i);
+        }
+        b->cache_bits = len * 8;
+    }
+}
+
+// move the read position forward by n >= 0 bits
+static inline void bs_advance(bs_t* b, int n)
+{
+    int bits = 8 - b->bits_left + n;
+    b->p += bits >> 3;
+    b->bits_left = 8 - (bits & 7);
+}
+
+// make sure the cache holds as many of the next n <= 57 bits as there are, and return the position of the next bit in it
+static inline int bs_cache_peek(bs_t* b, int n)
+{
+    uint64_t pos = (uint64_t)(b->p - b->cache_p) * 8 + (8 - b->bits_left);
+    if (pos + n > (uint64_t)b->cache_bits)
+    {
+        bs_refill(b);
+        pos = 8 - b->bits_left;
+    }
+    return (int)pos;
+}
+
+// like bs_cache_peek, for n bits which are about to be consumed: flags an error if they are not all there
+static inline int bs_cache_fill(bs_t* b, int n)
+{
+    int pos = bs_cache_peek(b, n);
+    if (pos + n > b->cache_bits) { b->error = 1; }
+    return pos;
+}
+
+/**
+ Find the last 1 bit in the buffer, scanning backwards from the end for the last nonzero byte.
+ In an RBSP this is the rbsp_stop_one_bit; any cabac_zero_words after it are skipped.
+ */
+static inline void bs_find_stop_bit(bs_t* b)
+{
+    uint8_t* q;
+    bs_unescape_all(b);
+    q = b->end;
+    while (q > b->start && q[-1] == 0) { q--; }
+
+    if (q == b->start) // no 1 bits at all, so no position is before one
+    {
+        b->stop_p = b->start;
+        b->stop_bits_left = 8;
+        return;
+    }
+
+    b->stop_p = q - 1;
+    b->stop_bits_left = 1;
+    while (((*b->stop_p) & (1 << (b->stop_bits_left - 1))) == 0) { b->stop_bits_left++; }
+}
+
+/**
+ Whether the read position is before the last 1 bit in the buffer, i.e. more_rbsp_data().
+ The bit is located on the first call for a buffer, later calls are a single comparison.
+ */
+static inline int bs_before_stop_bit(bs_t* b)
+{
+    if (b->stop_p == NULL) { bs_find_stop_bit(b); }
+    return (b->p < b->stop_p) || (b->p == b->stop_p && b->bits_left > b->stop_bits_left);
+}
+
+static inline int bs_clz32(uint32_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clz(x);
+#else
+    int n = 0;
+    while (!(x & 0x80000000)) { x <<= 1; n++; }
+    return n;
+#endif
+}
+
 static inline uint32_t bs_read_u1(bs_t* b)
 {
     uint32_t r = 0;
-    
+
+#ifdef FAST_READ_CACHE
+    int pos = bs_cache_fill(b, 1);
+    r = (uint32_t)(b->cache >> (63 - pos)) & 0x01;
+    bs_advance(b, 1);
+#else
     b->bits_left--;
 
     if (! bs_eof(b))
     {
         r = ((*(b->p)) >> b->bits_left) & 0x01;
     }
+    else
+    {
+        b->error = 1;
+    }
 
     if (b->bits_left == 0) { b->p ++; b->bits_left = 8; }
+#endif
 
     return r;
 }
@@ -147,10 +422,15 @@ static inline uint32_t bs_peek_u1(bs_t* b)
 {
     uint32_t r = 0;
 
+#ifdef FAST_READ_CACHE
+    int pos = bs_cache_peek(b, 1);
+    r = (uint32_t)(b->cache >> (63 - pos)) & 0x01;
+#else
     if (! bs_eof(b))
     {
         r = ((*(b->p)) >> ( b->bits_left - 1 )) & 0x01;
     }
+#endif
     return r;
 }
 
@@ -159,6 +439,15 @@ static inline uint32_t bs_read_u(bs_t* b, int n)
 {
     uint32_t r = 0;
     int i;
+#ifdef FAST_READ_CACHE
+    if (n > 0 && n <= 32) // can read from cache
+    {
+        int pos = bs_cache_fill(b, n);
+        r = (uint32_t)((b->cache << pos) >> (64 - n));
+        bs_advance(b, n);
+        return r;
+    }
+#endif
     for (i = 0; i < n; i++)
     {
         r |= ( bs_read_u1(b) << ( n - i - 1 ) );
@@ -168,15 +457,41 @@ static inline uint32_t bs_read_u(bs_t* b, int n)
 
 static inline void bs_skip_u(bs_t* b, int n)
 {
-    int i;
-    for ( i = 0; i < n; i++ ) 
-    {
-        bs_skip_u1( b );
-    }
+    if (n <= 0) { return; }
+    bs_need(b, (8 - b->bits_left + n + 7) >> 3);
+    bs_advance(b, n);
+    if (b->p > b->end || (b->p == b->end && b->bits_left < 8)) { b->error = 1; }
 }
 
 static inline uint32_t bs_read_f(bs_t* b, int n) { return bs_read_u(b, n); }
 
+/**
+ Read a field whose width 0 < n <= 32 is a constant.  Once inlined with a literal n, the range check
+ of bs_read_u is gone and the shifts are immediates.  Used through the width-specialized readers below,
+ which the generated parsers call for u(N) fields with a literal N.
+ */
+static inline uint32_t bs_read_un(bs_t* b, int n)
+{
+#ifdef FAST_READ_CACHE
+    int pos = bs_cache_fill(b, n);
+    uint32_t r = (uint32_t)((b->cache << pos) >> (64 - n));
+    bs_advance(b, n);
+    return r;
+#else
+    return bs_read_u(b, n);
+#endif
+}
+
+static inline uint32_t bs_read_u2(bs_t* b) { return bs_read_un(b, 2); }
+static inline uint32_t bs_read_u3(bs_t* b) { return bs_read_un(b, 3); }
+static inline uint32_t bs_read_u4(bs_t* b) { return bs_read_un(b, 4); }
+static inline uint32_t bs_read_u5(bs_t* b) { return bs_read_un(b, 5); }
+static inline uint32_t bs_read_u6(bs_t* b) { return bs_read_un(b, 6); }
+static inline uint32_t bs_read_u7(bs_t* b) { return bs_read_un(b, 7); }
+static inline uint32_t bs_read_u16(bs_t* b) { return bs_read_un(b, 16); }
+static inline uint32_t bs_read_u24(bs_t* b) { return bs_read_un(b, 24); }
+static inline uint32_t bs_read_u32(bs_t* b) { return bs_read_un(b, 32); }
+
 static inline uint32_t bs_read_u8(bs_t* b)
 {
 #ifdef FAST_U8
@@ -195,6 +510,50 @@ static inline uint32_t bs_read_ue(bs_t* b)
     int32_t r = 0;
     int i = 0;
 
+#ifdef FAST_READ_CACHE
+    // codes of up to 8 bits, indexed by the next byte: length in the high nibble, value in the low nibble
+    static const uint8_t ue_table[256] =
+    {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x77, 0x77, 0x78, 0x78, 0x79, 0x79, 0x7A, 0x7A, 0x7B, 0x7B, 0x7C, 0x7C, 0x7D, 0x7D, 0x7E, 0x7E,
+        0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54,
+        0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56,
+        0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+        0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+        0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+        0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    };
+
+    int pos = bs_cache_peek(b, 32);
+    uint32_t w = (uint32_t)((b->cache << pos) >> 32);
+    if (w >= 0x10000000)
+    {
+        i = ue_table[w >> 24] >> 4;
+        r = ue_table[w >> 24] & 0x0F;
+    }
+    else if (w >= 0x00010000)
+    {
+        i = 2 * bs_clz32(w) + 1;
+        r = (w >> (32 - i)) - 1;
+    }
+    // the whole code must lie before the end, otherwise fall through to the bit by bit version
+    if (i > 0 && pos + i <= b->cache_bits)
+    {
+        bs_advance(b, i);
+        return r;
+    }
+    r = 0;
+    i = 0;
+#endif
+
     while( (bs_read_u1(b) == 0) && (i < 32) && (!bs_eof(b)) )
     {
         i++;
@@ -204,6 +563,29 @@ static inline uint32_t bs_read_ue(bs_t* b)
     return r;
 }
 
+/**
+ Skip an Exp-Golomb code without computing its value.
+ */
+static inline void bs_skip_ue(bs_t* b)
+{
+#ifdef FAST_READ_CACHE
+    int pos = bs_cache_peek(b, 32);
+    uint32_t w = (uint32_t)((b->cache << pos) >> 32);
+    if (w >= 0x00010000)
+    {
+        int i = 2 * bs_clz32(w) + 1;
+        if (pos + i <= b->cache_bits)
+        {
+            bs_advance(b, i);
+            return;
+        }
+    }
+#endif
+    bs_read_ue(b);
+}
+
+static inline void bs_skip_se(bs_t* b) { bs_skip_ue(b); }
+
 static inline int32_t bs_read_se(bs_t* b) 
 {
     int32_t r = bs_read_ue(b);
@@ -218,10 +600,59 @@ static inline int32_t bs_read_se(bs_t* b)
     return r;
 }
 
+/**
+ Read n consecutive ue(v) codes into buf, or se(v) codes if is_signed.
+ Codes which fit in the cache are decoded with the position kept in a local, and only stored back
+ to the reader on a refill; anything else goes through bs_read_ue.  Stops early if the data runs out.
+ */
+static inline void bs_read_eg_array(bs_t* b, int* buf, int n, int is_signed)
+{
+    int i = 0;
+
+#ifdef FAST_READ_CACHE
+    int pos = bs_cache_peek(b, 32);
+    while (i < n && !b->error)
+    {
+        uint32_t w, r;
+        int len;
+        if (pos + 32 > b->cache_bits)
+        {
+            bs_advance(b, pos - (8 - b->bits_left) - (int)(b->p - b->cache_p) * 8);
+            pos = bs_cache_peek(b, 32);
+            if (pos + 32 > b->cache_bits) { break; } // near the end, finish bit by bit
+        }
+        w = (uint32_t)((b->cache << pos) >> 32);
+        if (w < 0x00010000) { break; } // code longer than 31 bits
+        len = 2 * bs_clz32(w) + 1;
+        r = (w >> (32 - len)) - 1;
+        pos += len;
+        if (is_signed) { buf[i] = (r & 0x01) ? (int)((r + 1) / 2) : -(int)(r / 2); }
+        else { buf[i] = r; }
+        i++;
+    }
+    bs_advance(b, pos - (8 - b->bits_left) - (int)(b->p - b->cache_p) * 8);
+#endif
+
+    for ( ; i < n && !b->error; i++)
+    {
+        buf[i] = is_signed ? bs_read_se(b) : (int)bs_read_ue(b);
+    }
+}
+
+static inline void bs_read_ue_array(bs_t* b, int* buf, int n) { bs_read_eg_array(b, buf, n, 0); }
+
+static inline void bs_read_se_array(bs_t* b, int* buf, int n) { bs_read_eg_array(b, buf, n, 1); }
+
+
+static inline void bs_write_u(bs_t* b, int n, uint32_t v);
 
 static inline void bs_write_u1(bs_t* b, uint32_t v)
 {
+#ifdef FAST_WRITE_ACCUM
+    bs_write_u(b, 1, v);
+#else
     b->bits_left--;
+    b->cache_bits = 0; // buffer contents changed under the read cache
 
     if (! bs_eof(b))
     {
@@ -233,22 +664,109 @@ static inline void bs_write_u1(bs_t* b, uint32_t v)
     }
 
     if (b->bits_left == 0) { b->p ++; b->bits_left = 8; }
+#endif
+}
+
+// store the oldest 32 pending bits to the buffer
+static inline void bs_write_spill(bs_t* b)
+{
+    uint32_t w = (uint32_t)(b->acc >> (b->acc_bits - 32));
+    int i;
+    if (b->end - b->acc_p >= 4)
+    {
+        b->acc_p[0] = w >> 24;
+        b->acc_p[1] = w >> 16;
+        b->acc_p[2] = w >>  8;
+        b->acc_p[3] = w;
+    }
+    else
+    {
+        for (i = 0; i < 4; i++)
+        {
+            if (b->acc_p + i < b->end) { b->acc_p[i] = w >> (24 - 8*i); }
+        }
+    }
+    b->acc_p += 4;
+    b->acc_bits -= 32;
+}
+
+/**
+ Store all pending bits to the buffer.  A partially written last byte keeps its remaining low bits.
+ Must be called before the buffer contents are used, and before writing directly to b->p.
+ */
+static inline void bs_write_flush(bs_t* b)
+{
+    if (b->acc_p == NULL) { return; }
+
+    while (b->acc_bits >= 8)
+    {
+        if (b->acc_p < b->end) { b->acc_p[0] = b->acc >> (b->acc_bits - 8); }
+        b->acc_p++;
+        b->acc_bits -= 8;
+    }
+    if (b->acc_bits > 0 && b->acc_p < b->end)
+    {
+        uint8_t mask = 0xFF << (8 - b->acc_bits);
+        b->acc_p[0] = (b->acc_p[0] & ~mask) | ((b->acc << (8 - b->acc_bits)) & mask);
+    }
+
+    b->acc_p = NULL;
+    b->acc_bits = 0;
+    b->cache_bits = 0; // buffer contents changed under the read cache
+    b->stop_p = NULL;
+}
+
+/**
+ Finish writing: flush pending bits and return the number of whole bytes written, like bs_pos.
+ */
+static inline int bs_write_finalize(bs_t* b)
+{
+    bs_write_flush(b);
+    return bs_pos(b);
 }
 
 static inline void bs_write_u(bs_t* b, int n, uint32_t v)
 {
     int i;
+#ifdef FAST_WRITE_ACCUM
+    if (n > 32) // the extra high bits are all zero
+    {
+        bs_write_u(b, n - 32, 0);
+        n = 32;
+    }
+    if (n > 0)
+    {
+        i = 8 - b->bits_left;
+        if (b->acc_p == NULL || (b->p - b->acc_p) * 8 + i != b->acc_bits)
+        {
+            // start accumulating at the current byte, keeping the bits already written to it
+            bs_write_flush(b);
+            b->acc_p = b->p;
+            b->acc_bits = i;
+            b->acc = (i > 0 && b->p < b->end) ? (b->p[0] >> b->bits_left) : 0;
+        }
+        if (b->acc_bits + n > 64) { bs_write_spill(b); }
+
+        b->acc = (b->acc << n) | (v & (0xFFFFFFFF >> (32 - n)));
+        b->acc_bits += n;
+
+        i += n;
+        b->p += i >> 3;
+        b->bits_left = 8 - (i & 7);
+    }
+#else
     for (i = 0; i < n; i++)
     {
         bs_write_u1(b, (v >> ( n - i - 1 ))&0x01 );
     }
+#endif
 }
 
 static inline void bs_write_f(bs_t* b, int n, uint32_t v) { bs_write_u(b, n, v); }
 
 static inline void bs_write_u8(bs_t* b, uint32_t v)
 {
-#ifdef FAST_U8
+#if defined(FAST_U8) && !defined(FAST_WRITE_ACCUM)
     if (b->bits_left == 8 && ! bs_eof(b)) // can do fast write
     {
         b->p[0] = v;
@@ -331,7 +849,8 @@ static inline void bs_write_se(bs_t* b, int32_t v)
 static inline int bs_read_bytes(bs_t* b, uint8_t* buf, int len)
 {
     int actual_len = len;
-    if (b->end - b->p < actual_len) { actual_len = b->end - b->p; }
+    bs_need(b, len);
+    if (b->end - b->p < actual_len) { actual_len = b->end - b->p; b->error = 1; }
     if (actual_len < 0) { actual_len = 0; }
     memcpy(buf, b->p, actual_len);
     if (len < 0) { len = 0; }
@@ -341,6 +860,8 @@ static inline int bs_read_bytes(bs_t* b, uint8_t* buf, int len)
 
 static inline int bs_write_bytes(bs_t* b, uint8_t* buf, int len)
 {
+    bs_write_flush(b);
+    b->cache_bits = 0;
     int actual_len = len;
     if (b->end - b->p < actual_len) { actual_len = b->end - b->p; }
     if (actual_len < 0) { actual_len = 0; }
@@ -353,13 +874,41 @@ static inline int bs_write_bytes(bs_t* b, uint8_t* buf, int len)
 static inline int bs_skip_bytes(bs_t* b, int len)
 {
     int actual_len = len;
-    if (b->end - b->p < actual_len) { actual_len = b->end - b->p; }
+    bs_need(b, len);
+    if (b->end - b->p < actual_len) { actual_len = b->end - b->p; b->error = 1; }
     if (actual_len < 0) { actual_len = 0; }
     if (len < 0) { len = 0; }
     b->p += len;
     return actual_len;
 }
 
+/**
+ Skip a run of whole bytes equal to v, starting at the current byte, e.g. filler data or cabac_zero_words.
+ Does nothing if not byte aligned.  Returns the number of bytes skipped.
+ */
+static inline int bs_skip_run(bs_t* b, uint8_t v)
+{
+    uint64_t pattern = 0x0101010101010101ULL * v;
+    uint64_t w;
+    uint8_t* q = b->p;
+    int n;
+
+    if (! bs_byte_aligned(b)) { return 0; }
+    bs_unescape_all(b);
+
+    while (b->end - q >= 8)
+    {
+        memcpy(&w, q, 8);
+        if (w != pattern) { break; }
+        q += 8;
+    }
+    while (q < b->end && *q == v) { q++; }
+
+    n = q - b->p;
+    b->p = q;
+    return n;
+}
+
 static inline uint32_t bs_next_bits(bs_t* bs, int nbits)
 {
    bs_t b;
@@ -373,6 +922,7 @@ static inline uint64_t bs_next_bytes(bs_t* bs, int nbytes)
    uint64_t val = 0;
 
    if ( (nbytes > 8) || (nbytes < 1) ) { return 0; }
+   bs_need(bs, nbytes);
    if (bs->p + nbytes > bs->end) { return 0; }
 
    for ( i = 0; i < nbytes; i++ ) { val = ( val << 8 ) | bs->p[i]; }
@@ -20,6 +20,7 @@
  */
 
 #include "h264_stream.h"
+#include "h264_index.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -27,8 +28,6 @@
 #include <string.h>
 #include <errno.h>
 
-#define BUFSIZE 32*1024*1024
-
 #if (defined(__GNUC__))
 #define HAVE_GETOPT_LONG
 
@@ -41,6 +40,10 @@ static struct option long_options[] =
     { "output",  required_argument, NULL, 'o'},
     { "help",    no_argument,       NULL, 'h'},
     { "verbose", required_argument, NULL, 'v'},
+    { "index",   no_argument,       NULL, 'x'},
+    { "threads", required_argument, NULL, 'j'},
+    { "index-file", required_argument, NULL, 'i'},
+    { NULL,      0,                 NULL, 0 },
 };
 #endif
 
@@ -48,6 +51,9 @@ static char options[] =
 "\t-o output_file, defaults to test.264\n"
 "\t-v verbose_level, print more info\n"
 "\t-p print codec for HTML5 video tag's codecs parameter, per RFC6381\n"
+"\t-x only list the NALs, one per line: offset size nal_unit_type nal_ref_idc access_unit\n"
+"\t-j threads, number of threads to use with -x, defaults to one per CPU\n"
+"\t-i index_file, with -x, read the index from index_file, or build it and write it there if it is missing or stale\n"
 "\t-h print this message and exit\n";
 
 void usage( )
@@ -60,18 +66,62 @@ void usage( )
     fprintf( stderr, "h264_analyze [options] <input bitstream>\noptions:\n%s\n", options);
 }
 
+typedef struct
+{
+    h264_stream_t* h;
+    int opt_verbose;
+    int opt_probe;
+} analyze_ctx_t;
+
+static int analyze_nal(void* opaque, int64_t offset, uint8_t* nal, int size)
+{
+    analyze_ctx_t* ctx = (analyze_ctx_t*)opaque;
+    h264_stream_t* h = ctx->h;
+
+    if ( ctx->opt_verbose > 0 )
+    {
+       fprintf( h264_dbgfile, "!! Found NAL at offset %lld (0x%04llX), size %lld (0x%04llX) \n",
+              (long long int)offset,
+              (long long int)offset,
+              (long long int)size,
+              (long long int)size );
+    }
+
+    read_debug_nal_unit(h, nal, size);
+
+    if ( ctx->opt_probe && h->nal->nal_unit_type == NAL_UNIT_TYPE_SPS )
+    {
+        // print codec parameter, per RFC 6381.
+        int constraint_byte = h->sps->constraint_set0_flag << 7;
+        constraint_byte = h->sps->constraint_set1_flag << 6;
+        constraint_byte = h->sps->constraint_set2_flag << 5;
+        constraint_byte = h->sps->constraint_set3_flag << 4;
+        constraint_byte = h->sps->constraint_set4_flag << 3;
+        constraint_byte = h->sps->constraint_set4_flag << 3;
+
+        fprintf( h264_dbgfile, "codec: avc1.%02X%02X%02X\n",h->sps->profile_idc, constraint_byte, h->sps->level_idc );
+
+        // TODO: add more, move to h264_stream (?)
+        return 1; // we've seen enough, bailing out.
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     FILE* infile;
 
-    uint8_t* buf = (uint8_t*)malloc( BUFSIZE );
-
     h264_stream_t* h = h264_new();
 
     if (argc < 2) { usage(); return EXIT_FAILURE; }
 
     int opt_verbose = 1;
     int opt_probe = 0;
+    int opt_index = 0;
+    int opt_threads = 0;
+    const char* opt_index_file = NULL;
+    const char* filename;
 
 #ifdef HAVE_GETOPT_LONG
     int c;
@@ -79,7 +129,7 @@ int main(int argc, char *argv[])
     extern char* optarg;
     extern int   optind;
 
-    while ( ( c = getopt_long( argc, argv, "o:phv:", long_options, &long_options_index) ) != -1 )
+    while ( ( c = getopt_long( argc, argv, "o:phv:xj:i:", long_options, &long_options_index) ) != -1 )
     {
         switch ( c )
         {
@@ -93,6 +143,15 @@ int main(int argc, char *argv[])
             case 'v':
                 opt_verbose = atoi( optarg );
                 break;
+            case 'x':
+                opt_index = 1;
+                break;
+            case 'j':
+                opt_threads = atoi( optarg );
+                break;
+            case 'i':
+                opt_index_file = optarg;
+                break;
             case 'h':
             default:
                 usage( );
@@ -100,99 +159,62 @@ int main(int argc, char *argv[])
         }
     }
 
-    infile = fopen(argv[optind], "rb");
+    if (optind >= argc) { usage(); return EXIT_FAILURE; }
+    filename = argv[optind];
 
 #else
 
-    infile = fopen(argv[1], "rb");
+    filename = argv[1];
 
 #endif
 
+    infile = fopen(filename, "rb");
     if (infile == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
 
     if (h264_dbgfile == NULL) { h264_dbgfile = stdout; }
     
-
-    size_t rsz = 0;
-    size_t sz = 0;
-    int64_t off = 0;
-    uint8_t* p = buf;
-
-    int nal_start, nal_end;
-
-    while (1)
+    if ( opt_index )
     {
-        rsz = fread(buf + sz, 1, BUFSIZE - sz, infile);
-        if (rsz == 0)
+        nal_index_t* idx = NULL;
+        int64_t au = -1;
+
+        if ( opt_index_file != NULL )
         {
-            if (ferror(infile)) { fprintf( stderr, "!! Error: read failed: %s \n", strerror(errno)); break; }
-            break;  // if (feof(infile)) 
+            // a stale index is one made from a file of a different size or contents
+            idx = nal_index_open(opt_index_file);
+            if (idx != NULL && !nal_index_matches_file(idx, filename)) { nal_index_free(idx); idx = NULL; }
         }
 
-        sz += rsz;
-
-        while (find_nal_unit(p, sz, &nal_start, &nal_end) > 0)
+        if ( idx == NULL )
         {
-            if ( opt_verbose > 0 )
-            {
-               fprintf( h264_dbgfile, "!! Found NAL at offset %lld (0x%04llX), size %lld (0x%04llX) \n",
-                      (long long int)(off + (p - buf) + nal_start),
-                      (long long int)(off + (p - buf) + nal_start),
-                      (long long int)(nal_end - nal_start),
-                      (long long int)(nal_end - nal_start) );
-            }
-
-            p += nal_start;
-            read_debug_nal_unit(h, p, nal_end - nal_start);
-
-            if ( opt_probe && h->nal->nal_unit_type == NAL_UNIT_TYPE_SPS )
-            {
-                // print codec parameter, per RFC 6381.
-                int constraint_byte = h->sps->constraint_set0_flag << 7;
-                constraint_byte = h->sps->constraint_set1_flag << 6;
-                constraint_byte = h->sps->constraint_set2_flag << 5;
-                constraint_byte = h->sps->constraint_set3_flag << 4;
-                constraint_byte = h->sps->constraint_set4_flag << 3;
-                constraint_byte = h->sps->constraint_set4_flag << 3;
-
-                fprintf( h264_dbgfile, "codec: avc1.%02X%02X%02X\n",h->sps->profile_idc, constraint_byte, h->sps->level_idc );
-
-                // TODO: add more, move to h264_stream (?)
-                break; // we've seen enough, bailing out.
-            }
-
-            if ( opt_verbose > 0 )
-            {
-                // fprintf( h264_dbgfile, "XX ");
-                // debug_bytes(p-4, nal_end - nal_start + 4 >= 16 ? 16: nal_end - nal_start + 4);
-
-                // debug_nal(h, h->nal);
-            }
-
-            p += (nal_end - nal_start);
-            sz -= nal_end;
+            // the file is split between threads, each reading its own part
+            idx = nal_index_new();
+            if (nal_index_build_file(idx, filename, opt_threads) < 0) { fprintf( stderr, "!! Error: could not index file: %s \n", strerror(errno)); }
+            else if (opt_index_file != NULL && nal_index_write(idx, opt_index_file) < 0) { fprintf( stderr, "!! Error: could not write index: %s \n", strerror(errno)); }
         }
 
-        // if no NALs found in buffer, discard it
-        if (p == buf) 
+        for (int64_t i = 0; i < idx->num_entries; i++)
         {
-            fprintf( stderr, "!! Did not find any NALs between offset %lld (0x%04llX), size %lld (0x%04llX), discarding \n",
-                   (long long int)off, 
-                   (long long int)off, 
-                   (long long int)off + sz, 
-                   (long long int)off + sz);
-
-            p = buf + sz;
-            sz = 0;
+            nal_index_entry_t* e = &idx->entries[i];
+            if (au + 1 < idx->num_aus && idx->aus[au + 1] == i) { au++; }
+            fprintf( h264_dbgfile, "%lld %lld %d %d %lld\n", (long long int)e->offset, (long long int)e->size, e->nal_unit_type, e->nal_ref_idc, (long long int)au );
         }
 
-        memmove(buf, p, sz);
-        off += p - buf;
-        p = buf;
+        nal_index_free(idx);
+        h264_free(h);
+        fclose(h264_dbgfile);
+        fclose(infile);
+        return 0;
     }
 
+
+    // regular files are mapped, pipes are read in chunks
+    analyze_ctx_t ctx = { h, opt_verbose, opt_probe };
+    nal_splitter_t* splitter = nal_splitter_new(analyze_nal, &ctx);
+    if (nal_splitter_push_file(splitter, infile) < 0) { fprintf( stderr, "!! Error: read failed: %s \n", strerror(errno)); }
+
+    nal_splitter_free(splitter);
     h264_free(h);
-    free(buf);
 
     fclose(h264_dbgfile);
     fclose(infile);
@@ -110,7 +110,7 @@ int write_avcc(avcc_t* avcc, h264_stream_t* h, bs_t* b)
   }
 
   if (bs_overrun(b)) { return -1; }
-  return bs_pos(b);
+  return bs_write_finalize(b);
 }
 
 void debug_avcc(avcc_t* avcc)
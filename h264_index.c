@@ -0,0 +1,681 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// pread, sysconf, mmap
+#define _XOPEN_SOURCE 700
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "bs.h"
+#include "h264_index.h"
+#include "h264_sei.h"
+
+// bytes scanned per call to find_zero_pair, and read per pread
+#ifndef INDEX_CHUNK_SIZE
+#define INDEX_CHUNK_SIZE (4*1024*1024)
+#endif
+// a file is not split into ranges smaller than this
+#ifndef INDEX_MIN_RANGE_SIZE
+#define INDEX_MIN_RANGE_SIZE (16*1024*1024)
+#endif
+// bytes of a NAL read to parse its headers
+#define INDEX_HEAD_SIZE 1024
+// bytes at each end of the stream which go into stream_hash
+#define INDEX_HASH_SIZE 4096
+
+#define INDEX_FILE_MAGIC "H264NIDX"
+#define INDEX_FILE_VERSION 2
+#define INDEX_FILE_BYTE_ORDER 0x01020304
+
+/*
+ Index file layout: this header, then the entries, aus and raps arrays as they are in memory, in native byte order.
+ Every part is a multiple of 8 bytes, so all of them are aligned in a mapping of the file.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    int64_t stream_size;
+    uint64_t stream_hash;
+    int64_t num_entries;
+    int64_t num_aus;
+    int64_t num_raps;
+} nal_index_file_header_t;
+
+/*
+ In the order find_nal_unit sees them, every 00 00 01 starts a NAL, and a NAL ends at the first 00 00 00 or 00 00 01
+ after its start code (which cannot begin within the start code itself).  So each part of a stream can be scanned on
+ its own: only the last NAL which starts in a range may end in a later range, at the first code found there.
+ */
+typedef struct
+{
+    const uint8_t* buf; // the whole stream, or NULL to read it from fd
+    int fd;
+    int64_t size;       // of the whole stream
+    int64_t from;       // the range to scan, codes which start at from <= i < to
+    int64_t to;
+    nal_index_t idx;    // NALs which start in the range; the size of the last one is -1 if it ends after the range
+    int64_t first_code; // position of the first 00 00 00 or 00 00 01 in the range, -1 if none
+    int error;
+} nal_index_range_t;
+
+/**
+ Create an empty NAL index.
+ @return    the index
+ */
+nal_index_t* nal_index_new()
+{
+    return (nal_index_t*)calloc(1, sizeof(nal_index_t));
+}
+
+/**
+ Free a NAL index and its entries.
+ */
+void nal_index_free(nal_index_t* idx)
+{
+    if (idx->map != NULL)
+    {
+        munmap(idx->map, (size_t)idx->map_size);
+    }
+    else
+    {
+        if (idx->entries != NULL) { free(idx->entries); }
+        if (idx->aus != NULL) { free(idx->aus); }
+        if (idx->raps != NULL) { free(idx->raps); }
+    }
+    free(idx);
+}
+
+static void nal_index_add(nal_index_t* idx, const nal_index_entry_t* e)
+{
+    if (idx->num_entries == idx->capacity)
+    {
+        idx->capacity = (idx->capacity > 0) ? idx->capacity * 2 : 1024;
+        idx->entries = (nal_index_entry_t*)realloc(idx->entries, idx->capacity * sizeof(nal_index_entry_t));
+    }
+    idx->entries[idx->num_entries++] = *e;
+}
+
+// the last entry of idx ends at end; empty NALs are dropped, as find_nal_unit skips them
+static void nal_index_end(nal_index_t* idx, int64_t end)
+{
+    nal_index_entry_t* e = &idx->entries[idx->num_entries - 1];
+    e->size = end - e->offset;
+    if (e->size <= 0) { idx->num_entries--; }
+}
+
+// scan len bytes of data starting at stream offset pos; avail >= len bytes are there, with up to 3 more for lookahead
+static void nal_index_scan(nal_index_range_t* r, const uint8_t* data, int64_t pos, int len, int avail)
+{
+    int i = 0;
+    int k;
+
+    while ((k = find_zero_pair(data, i, avail, 0xFE, 0x00)) >= 0 && k < len)
+    {
+        if (r->first_code < 0) { r->first_code = pos + k; }
+        if (r->idx.num_entries > 0 && r->idx.entries[r->idx.num_entries - 1].size < 0) { nal_index_end(&r->idx, pos + k); }
+
+        // a start code at the very end of the stream starts an empty NAL
+        if (data[k+2] == 0x01 && k + 3 < avail)
+        {
+            nal_index_entry_t e;
+            e.offset = pos + k + 3;
+            e.size = -1;
+            e.nal_unit_type = data[k+3] & 0x1F;
+            e.nal_ref_idc = (data[k+3] >> 5) & 0x03;
+            nal_index_add(&r->idx, &e);
+        }
+        i = k + 1;
+    }
+}
+
+static int nal_index_pread(int fd, uint8_t* buf, int len, int64_t pos)
+{
+    int n = 0;
+    while (n < len)
+    {
+        ssize_t rc = pread(fd, buf + n, len - n, (off_t)(pos + n));
+        if (rc <= 0) { return -1; }
+        n += rc;
+    }
+    return n;
+}
+
+static void* nal_index_scan_range(void* arg)
+{
+    nal_index_range_t* r = (nal_index_range_t*)arg;
+    uint8_t* chunk = NULL;
+    int64_t pos;
+
+    if (r->buf == NULL) { chunk = (uint8_t*)malloc(INDEX_CHUNK_SIZE + 3); }
+
+    for (pos = r->from; pos < r->to; pos += INDEX_CHUNK_SIZE)
+    {
+        int len = (r->to - pos < INDEX_CHUNK_SIZE) ? (int)(r->to - pos) : INDEX_CHUNK_SIZE;
+        int avail = (r->size - pos < len + 3) ? (int)(r->size - pos) : len + 3;
+
+        if (r->buf != NULL)
+        {
+            nal_index_scan(r, r->buf + pos, pos, len, avail);
+        }
+        else
+        {
+            if (nal_index_pread(r->fd, chunk, avail, pos) < 0) { r->error = 1; break; }
+            nal_index_scan(r, chunk, pos, len, avail);
+        }
+    }
+
+    if (chunk != NULL) { free(chunk); }
+    return NULL;
+}
+
+static int nal_index_num_threads(int num_threads, int64_t size)
+{
+    int64_t max_threads = size / INDEX_MIN_RANGE_SIZE;
+
+    if (num_threads <= 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (num_threads <= 0) { num_threads = 1; }
+    }
+    if (num_threads > max_threads) { num_threads = (max_threads > 0) ? (int)max_threads : 1; }
+#ifndef HAVE_LIBPTHREAD
+    num_threads = 1;
+#endif
+    return num_threads;
+}
+
+// the start of the NAL of entry e, at most INDEX_HEAD_SIZE bytes of it, in the mapping or else read into head;
+// returns NULL if it could not be read
+static const uint8_t* nal_index_head(const uint8_t* buf, int fd, const nal_index_entry_t* e, uint8_t* head, int* size)
+{
+    *size = (e->size < INDEX_HEAD_SIZE) ? (int)e->size : INDEX_HEAD_SIZE;
+    if (buf != NULL) { return buf + e->offset; }
+    if (nal_index_pread(fd, head, *size, e->offset) < 0) { return NULL; }
+    return head;
+}
+
+// 7.3.2.3.1 sei_message(), skipping everything but a recovery point; returns its recovery_frame_cnt, or -1 if none
+static int nal_index_recovery_point(const uint8_t* nal, int size)
+{
+    uint8_t rbsp[INDEX_HEAD_SIZE];
+    int rbsp_size = size;
+    bs_t b;
+
+    // a head cut off in the middle of an emulation prevention sequence is still fine, a bad one is not parsed
+    if (nal_to_rbsp(nal, &size, rbsp, &rbsp_size) < 0 || rbsp_size < 1) { return -1; }
+    bs_init(&b, rbsp + 1, rbsp_size - 1);
+
+    while (!bs_error(&b) && bs_bytes_left(&b) > 1)
+    {
+        int payloadType = 0;
+        int payloadSize = 0;
+        int x;
+        do { x = bs_read_u8(&b); payloadType += x; } while (x == 0xFF && !bs_error(&b));
+        do { x = bs_read_u8(&b); payloadSize += x; } while (x == 0xFF && !bs_error(&b));
+        if (payloadType == SEI_TYPE_RECOVERY_POINT)
+        {
+            int cnt = bs_read_ue(&b);
+            return bs_error(&b) ? -1 : cnt;
+        }
+        bs_skip_bytes(&b, payloadSize);
+    }
+    return -1;
+}
+
+// find the access units and random access points; access units are found by au_detector_push, as au_iterator_next
+// does, so their numbers are the same as an iterator's over the same stream
+static int nal_index_find_aus(nal_index_t* idx, const uint8_t* buf, int fd)
+{
+    h264_stream_t* h = h264_new();
+    au_detector_t d;
+    int64_t sps_entry[32];
+    int64_t pps_entry[256];
+    int pps_sps_id[256];
+    int recovery_frame_cnt = -1;
+    uint8_t head[INDEX_HEAD_SIZE];
+    int64_t i;
+    int j;
+    int rc = 0;
+
+    memset(&d, 0, sizeof(d));
+    for (j = 0; j < 32; j++) { sps_entry[j] = -1; }
+    for (j = 0; j < 256; j++) { pps_entry[j] = -1; pps_sps_id[j] = 0; }
+
+    idx->aus = (int64_t*)realloc(idx->aus, (idx->num_entries + 1) * sizeof(int64_t));
+    idx->raps = (nal_index_rap_t*)realloc(idx->raps, (idx->num_entries + 1) * sizeof(nal_index_rap_t));
+    idx->num_aus = 0;
+    idx->num_raps = 0;
+
+    for (i = 0; i < idx->num_entries; i++)
+    {
+        const nal_index_entry_t* e = &idx->entries[i];
+        int t = e->nal_unit_type;
+        const uint8_t* nal = NULL;
+        int size = 0;
+        int read_ok = 0;
+        int had_vcl = d.has_vcl;
+
+        // au_detector_push needs no more than the NAL header of other NALs
+        if (t == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR || t == NAL_UNIT_TYPE_CODED_SLICE_IDR ||
+            t == NAL_UNIT_TYPE_SPS || t == NAL_UNIT_TYPE_PPS || t == NAL_UNIT_TYPE_SEI)
+        {
+            nal = nal_index_head(buf, fd, e, head, &size);
+            if (nal == NULL) { rc = -1; break; }
+            if (t != NAL_UNIT_TYPE_SEI) { read_ok = (read_nal_unit_headers(h, (uint8_t*)nal, size) >= 0); }
+        }
+        h->nal->nal_ref_idc = e->nal_ref_idc;
+        h->nal->nal_unit_type = t;
+
+        if (au_detector_push(&d, h))
+        {
+            idx->aus[idx->num_aus++] = i;
+            had_vcl = 0;
+            recovery_frame_cnt = -1;
+        }
+
+        // the first slice of the primary coded picture of an access unit
+        if (!had_vcl && d.has_vcl && (t == NAL_UNIT_TYPE_CODED_SLICE_IDR || recovery_frame_cnt >= 0))
+        {
+            nal_index_rap_t* r = &idx->raps[idx->num_raps++];
+            int pic_parameter_set_id = read_ok ? h->sh->pic_parameter_set_id : -1;
+            r->au = idx->num_aus - 1;
+            r->type = (t == NAL_UNIT_TYPE_CODED_SLICE_IDR) ? NAL_INDEX_RAP_IDR : NAL_INDEX_RAP_RECOVERY_POINT;
+            r->recovery_frame_cnt = (t == NAL_UNIT_TYPE_CODED_SLICE_IDR) ? 0 : recovery_frame_cnt;
+            r->pps = (pic_parameter_set_id >= 0 && pic_parameter_set_id < 256) ? pps_entry[pic_parameter_set_id] : -1;
+            r->sps = (r->pps >= 0) ? sps_entry[pps_sps_id[pic_parameter_set_id]] : -1;
+        }
+
+        if (t == NAL_UNIT_TYPE_SPS && read_ok)
+        {
+            int seq_parameter_set_id = h->sps->seq_parameter_set_id;
+            if (seq_parameter_set_id >= 0 && seq_parameter_set_id < 32) { sps_entry[seq_parameter_set_id] = i; }
+        }
+        else if (t == NAL_UNIT_TYPE_PPS && read_ok)
+        {
+            int pic_parameter_set_id = h->pps->pic_parameter_set_id;
+            int seq_parameter_set_id = h->pps->seq_parameter_set_id;
+            if (pic_parameter_set_id >= 0 && pic_parameter_set_id < 256 &&
+                seq_parameter_set_id >= 0 && seq_parameter_set_id < 32)
+            {
+                pps_entry[pic_parameter_set_id] = i;
+                pps_sps_id[pic_parameter_set_id] = seq_parameter_set_id;
+            }
+        }
+        else if (t == NAL_UNIT_TYPE_SEI)
+        {
+            int cnt = nal_index_recovery_point(nal, size);
+            if (cnt >= 0) { recovery_frame_cnt = cnt; }
+        }
+    }
+
+    h264_free(h);
+    return rc;
+}
+
+// 64-bit FNV-1a of the first and last INDEX_HASH_SIZE bytes of a stream, from buf or else read from fd; returns -1
+// if it could not be read
+static int nal_index_hash(const uint8_t* buf, int fd, int64_t size, uint64_t* hash)
+{
+    uint8_t part[INDEX_HASH_SIZE];
+    int64_t from[2];
+    int k;
+
+    from[0] = 0;
+    from[1] = (size > 2 * INDEX_HASH_SIZE) ? size - INDEX_HASH_SIZE : INDEX_HASH_SIZE;
+    *hash = 0xCBF29CE484222325ULL;
+    for (k = 0; k < 2; k++)
+    {
+        int len = (size - from[k] < INDEX_HASH_SIZE) ? (int)(size - from[k]) : INDEX_HASH_SIZE;
+        const uint8_t* p = part;
+        int i;
+
+        if (len <= 0) { break; }
+        if (buf != NULL) { p = buf + from[k]; }
+        else if (nal_index_pread(fd, part, len, from[k]) < 0) { return -1; }
+        for (i = 0; i < len; i++)
+        {
+            *hash ^= p[i];
+            *hash *= 0x100000001B3ULL;
+        }
+    }
+    return 0;
+}
+
+// scan the ranges in parallel, then join their NALs up in order
+static int nal_index_build_ranges(nal_index_t* idx, const uint8_t* buf, int fd, int64_t size, int num_threads)
+{
+    nal_index_range_t* ranges;
+    int n = nal_index_num_threads(num_threads, size);
+    int rc = 0;
+    int i;
+
+    // an index opened from a file is replaced by one in memory, as its arrays cannot be grown
+    if (idx->map != NULL)
+    {
+        munmap(idx->map, (size_t)idx->map_size);
+        idx->map = NULL;
+        idx->map_size = 0;
+        idx->entries = NULL;
+        idx->capacity = 0;
+        idx->aus = NULL;
+        idx->raps = NULL;
+    }
+
+    ranges = (nal_index_range_t*)calloc(n, sizeof(nal_index_range_t));
+    for (i = 0; i < n; i++)
+    {
+        ranges[i].buf = buf;
+        ranges[i].fd = fd;
+        ranges[i].size = size;
+        ranges[i].from = size * i / n;
+        ranges[i].to = size * (i + 1) / n;
+        ranges[i].first_code = -1;
+    }
+
+#ifdef HAVE_LIBPTHREAD
+    {
+        pthread_t* threads = (pthread_t*)calloc(n, sizeof(pthread_t));
+        int* started = (int*)calloc(n, sizeof(int));
+        for (i = 1; i < n; i++) { started[i] = (pthread_create(&threads[i], NULL, nal_index_scan_range, &ranges[i]) == 0); }
+        nal_index_scan_range(&ranges[0]);
+        for (i = 1; i < n; i++)
+        {
+            if (started[i]) { pthread_join(threads[i], NULL); }
+            else { nal_index_scan_range(&ranges[i]); }
+        }
+        free(started);
+        free(threads);
+    }
+#else
+    for (i = 0; i < n; i++) { nal_index_scan_range(&ranges[i]); }
+#endif
+
+    idx->num_entries = 0;
+    idx->num_aus = 0;
+    idx->num_raps = 0;
+    for (i = 0; i < n; i++)
+    {
+        nal_index_range_t* r = &ranges[i];
+        int64_t j;
+
+        if (r->error) { rc = -1; }
+
+        // a NAL left open by an earlier range ends at the first code of this one
+        if (r->first_code >= 0 && idx->num_entries > 0 && idx->entries[idx->num_entries - 1].size < 0)
+        {
+            nal_index_end(idx, r->first_code);
+        }
+
+        for (j = 0; j < r->idx.num_entries; j++) { nal_index_add(idx, &r->idx.entries[j]); }
+        if (r->idx.entries != NULL) { free(r->idx.entries); }
+    }
+    free(ranges);
+
+    // the last NAL runs to the end of the stream, less trailing zeros; there are at most two, or there would be a code
+    if (idx->num_entries > 0 && idx->entries[idx->num_entries - 1].size < 0)
+    {
+        uint8_t tail[2] = { 0xFF, 0xFF };
+        int64_t end = size;
+        int len = (size >= 2) ? 2 : (int)size;
+
+        if (buf != NULL) { memcpy(tail + 2 - len, buf + size - len, len); }
+        else if (nal_index_pread(fd, tail + 2 - len, len, size - len) < 0) { rc = -1; }
+
+        if (tail[1] == 0x00) { end--; if (tail[0] == 0x00) { end--; } }
+        nal_index_end(idx, end);
+    }
+
+    idx->stream_size = size;
+    if (rc == 0) { rc = nal_index_hash(buf, fd, size, &idx->stream_hash); }
+    if (rc == 0) { rc = nal_index_find_aus(idx, buf, fd); }
+
+    return rc;
+}
+
+/**
+ Build an index of all the NALs in a buffer holding an Annex B byte stream.  The buffer is split into ranges which
+ are scanned for start codes by separate threads; the result is the same as splitting it with find_nal_unit or the
+ NAL splitter, including the last NAL, which has no end code.  Then the headers of slices, parameter sets and SEI
+ are read to find the access units and random access points.
+ @param[out]  idx          the index from nal_index_new or nal_index_open, any previous entries are replaced
+ @param[in]   buf          the stream
+ @param[in]   size         the size of the stream
+ @param[in]   num_threads  the number of threads to use, or 0 for one per CPU; small streams use fewer
+ @return                   0, or -1 on error
+ */
+int nal_index_build(nal_index_t* idx, const uint8_t* buf, int64_t size, int num_threads)
+{
+    return nal_index_build_ranges(idx, buf, -1, size, num_threads);
+}
+
+/**
+ Build an index of all the NALs in a file holding an Annex B byte stream, as nal_index_build.
+ Each thread reads its own part of the file.
+ @return                   0, or -1 on error
+ */
+int nal_index_build_file(nal_index_t* idx, const char* filename, int num_threads)
+{
+    struct stat st;
+    int rc;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) { return -1; }
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+
+    rc = nal_index_build_ranges(idx, NULL, fd, (int64_t)st.st_size, num_threads);
+
+    close(fd);
+    return rc;
+}
+
+/**
+ Write an index to a file, which nal_index_open can map.  The file is in the byte order of this machine.
+ @return    0, or -1 on error
+ */
+int nal_index_write(const nal_index_t* idx, const char* filename)
+{
+    nal_index_file_header_t hdr;
+    FILE* f;
+    int rc = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.byte_order = INDEX_FILE_BYTE_ORDER;
+    hdr.version = INDEX_FILE_VERSION;
+    hdr.stream_size = idx->stream_size;
+    hdr.stream_hash = idx->stream_hash;
+    hdr.num_entries = idx->num_entries;
+    hdr.num_aus = idx->num_aus;
+    hdr.num_raps = idx->num_raps;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) { return -1; }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(idx->entries, sizeof(nal_index_entry_t), (size_t)idx->num_entries, f) != (size_t)idx->num_entries ||
+        fwrite(idx->aus, sizeof(int64_t), (size_t)idx->num_aus, f) != (size_t)idx->num_aus ||
+        fwrite(idx->raps, sizeof(nal_index_rap_t), (size_t)idx->num_raps, f) != (size_t)idx->num_raps)
+    {
+        rc = -1;
+    }
+    if (fclose(f) != 0) { rc = -1; }
+
+    return rc;
+}
+
+// whether the access units and random access points of an index point at its entries and are in order
+static int nal_index_valid(const nal_index_t* idx)
+{
+    int64_t i;
+
+    for (i = 0; i < idx->num_aus; i++)
+    {
+        if (idx->aus[i] < 0 || idx->aus[i] >= idx->num_entries) { return 0; }
+        if (i > 0 && idx->aus[i] <= idx->aus[i - 1]) { return 0; }
+    }
+    for (i = 0; i < idx->num_raps; i++)
+    {
+        const nal_index_rap_t* r = &idx->raps[i];
+        if (r->au < 0 || r->au >= idx->num_aus) { return 0; }
+        if (i > 0 && r->au <= idx->raps[i - 1].au) { return 0; }
+        if (r->sps < -1 || r->sps >= idx->num_entries) { return 0; }
+        if (r->pps < -1 || r->pps >= idx->num_entries) { return 0; }
+    }
+    return 1;
+}
+
+/**
+ Map an index file written by nal_index_write; nothing in it is parsed or copied, though the access units and random
+ access points are checked.  The entries can be changed, but
+ the changes stay in memory.  Check the index with nal_index_matches_file or nal_index_matches to tell whether it is
+ stale.
+ @return    the index, to be freed with nal_index_free, or NULL if the file is missing or not a valid index
+ */
+nal_index_t* nal_index_open(const char* filename)
+{
+    nal_index_file_header_t hdr;
+    nal_index_t* idx;
+    struct stat st;
+    uint8_t* map;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) { return NULL; }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(hdr) || nal_index_pread(fd, (uint8_t*)&hdr, sizeof(hdr), 0) < 0 ||
+        memcmp(hdr.magic, INDEX_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.byte_order != INDEX_FILE_BYTE_ORDER || hdr.version != INDEX_FILE_VERSION ||
+        hdr.num_entries < 0 || hdr.num_aus < 0 || hdr.num_raps < 0 ||
+        hdr.num_entries > (int64_t)st.st_size / (int64_t)sizeof(nal_index_entry_t) ||
+        hdr.num_aus > hdr.num_entries || hdr.num_raps > hdr.num_aus ||
+        (int64_t)st.st_size != (int64_t)sizeof(hdr) + hdr.num_entries * (int64_t)sizeof(nal_index_entry_t) +
+                               hdr.num_aus * (int64_t)sizeof(int64_t) + hdr.num_raps * (int64_t)sizeof(nal_index_rap_t))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // private and writable, so that stray writes to the entries do not fault
+    map = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == (uint8_t*)MAP_FAILED) { return NULL; }
+
+    idx = nal_index_new();
+    idx->map = map;
+    idx->map_size = (int64_t)st.st_size;
+    idx->stream_size = hdr.stream_size;
+    idx->stream_hash = hdr.stream_hash;
+    idx->entries = (nal_index_entry_t*)(map + sizeof(hdr));
+    idx->num_entries = hdr.num_entries;
+    idx->capacity = hdr.num_entries;
+    idx->aus = (int64_t*)(idx->entries + hdr.num_entries);
+    idx->num_aus = hdr.num_aus;
+    idx->raps = (nal_index_rap_t*)(idx->aus + hdr.num_aus);
+    idx->num_raps = hdr.num_raps;
+
+    // the lookups index entries by these without checking, so a corrupt file must not get this far
+    if (!nal_index_valid(idx))
+    {
+        nal_index_free(idx);
+        return NULL;
+    }
+
+    return idx;
+}
+
+/**
+ Tell whether an index was built from a stream, going by its size and a hash of its first and last few KB.
+ @return    1 if it was, 0 if not
+ */
+int nal_index_matches(const nal_index_t* idx, const uint8_t* buf, int64_t size)
+{
+    uint64_t hash;
+    if (size != idx->stream_size) { return 0; }
+    return (nal_index_hash(buf, -1, size, &hash) == 0 && hash == idx->stream_hash);
+}
+
+/**
+ Tell whether an index was built from a file, as nal_index_matches.
+ @return    1 if it was, 0 if not or the file could not be read
+ */
+int nal_index_matches_file(const nal_index_t* idx, const char* filename)
+{
+    struct stat st;
+    uint64_t hash;
+    int rc = 0;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) { return 0; }
+    if (fstat(fd, &st) == 0 && (int64_t)st.st_size == idx->stream_size &&
+        nal_index_hash(NULL, fd, (int64_t)st.st_size, &hash) == 0 && hash == idx->stream_hash)
+    {
+        rc = 1;
+    }
+    close(fd);
+    return rc;
+}
+
+/**
+ Find the access unit which holds a stream offset.
+ @return    the access unit, or -1 if the offset is before the first one
+ */
+int64_t nal_index_find_au(const nal_index_t* idx, int64_t offset)
+{
+    int64_t lo = 0;
+    int64_t hi = idx->num_aus;
+
+    // the last access unit whose first NAL starts at or before offset
+    while (lo < hi)
+    {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[idx->aus[mid]].offset <= offset) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return lo - 1;
+}
+
+/**
+ Find the random access point to start decoding from to reach an access unit.
+ @return    the last random access point at or before the access unit, or -1 if there is none
+ */
+int64_t nal_index_find_rap(const nal_index_t* idx, int64_t au)
+{
+    int64_t lo = 0;
+    int64_t hi = idx->num_raps;
+
+    while (lo < hi)
+    {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (idx->raps[mid].au <= au) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return lo - 1;
+}
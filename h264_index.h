@@ -0,0 +1,74 @@
+#ifndef _H264_INDEX_H
+#define _H264_INDEX_H        1
+
+#include <stdint.h>
+
+#include "h264_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   One NAL of an Annex B byte stream, as found by find_nal_unit or the NAL splitter.
+   The layout is fixed, as index files hold an array of these as is.
+*/
+typedef struct
+{
+    int64_t offset;         // stream offset of the first byte of the NAL, after the start code
+    int64_t size;           // without the start code and any trailing zero bytes
+    int32_t nal_unit_type;
+    int32_t nal_ref_idc;
+} nal_index_entry_t;
+
+#define NAL_INDEX_RAP_IDR             1
+#define NAL_INDEX_RAP_RECOVERY_POINT  2
+
+/**
+   A random access point: an access unit holding an IDR picture, or one with a recovery point SEI.
+*/
+typedef struct
+{
+    int64_t au;                 // the access unit
+    int64_t sps;                // entry of the SPS active at the first slice, -1 if it was not in the stream before
+    int64_t pps;                // entry of the PPS active at the first slice, -1 if it was not in the stream before
+    int32_t type;               // NAL_INDEX_RAP_IDR or NAL_INDEX_RAP_RECOVERY_POINT
+    int32_t recovery_frame_cnt; // from the recovery point SEI, 0 for IDR
+} nal_index_rap_t;
+
+/**
+   Index of all the NALs of a stream, in stream order, with the access units they make up and the random access
+   points among those.  An index read with nal_index_open points into the mapped file until it is built again.
+   @see nal_index_build
+*/
+typedef struct
+{
+    nal_index_entry_t* entries;
+    int64_t num_entries;
+    int64_t capacity;
+    int64_t* aus;               // entry of the first NAL of each access unit
+    int64_t num_aus;
+    nal_index_rap_t* raps;
+    int64_t num_raps;
+    int64_t stream_size;        // size of the indexed stream, to tell whether an index file is stale
+    uint64_t stream_hash;       // hash of the first and last few KB of the stream, likewise; see nal_index_matches
+    void* map;                  // the mapped index file, NULL if built in memory
+    int64_t map_size;
+} nal_index_t;
+
+nal_index_t* nal_index_new();
+void nal_index_free(nal_index_t* idx);
+int nal_index_build(nal_index_t* idx, const uint8_t* buf, int64_t size, int num_threads);
+int nal_index_build_file(nal_index_t* idx, const char* filename, int num_threads);
+int nal_index_write(const nal_index_t* idx, const char* filename);
+nal_index_t* nal_index_open(const char* filename);
+int nal_index_matches(const nal_index_t* idx, const uint8_t* buf, int64_t size);
+int nal_index_matches_file(const nal_index_t* idx, const char* filename);
+int64_t nal_index_find_au(const nal_index_t* idx, int64_t offset);
+int64_t nal_index_find_rap(const nal_index_t* idx, int64_t au);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
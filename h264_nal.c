@@ -20,16 +20,40 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifdef HAVE_MMAP
+// fileno, madvise
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 #include "bs.h"
 #include "h264_stream.h"
 #include "h264_sei.h"
+#include "h264_ps_store.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// bytes read at a time from files which cannot be mapped
+#define NAL_SPLITTER_READ_SIZE (1024*1024)
 
 /**
- Create a new H264 stream object.  Allocates all structures contained within it.
+ Create a new H264 stream object.  Allocates all structures contained within it, except for the entries of the
+ parameter set tables, which are allocated as parameter sets with those ids are read.
  @return    the stream object
  */
 h264_stream_t* h264_new()
@@ -39,24 +63,20 @@ h264_stream_t* h264_new()
     h->nal = (nal_t*)calloc(1, sizeof(nal_t));
     h->nal->nal_svc_ext = (nal_svc_ext_t*) calloc(1, sizeof(nal_svc_ext_t));
     h->nal->prefix_nal_svc = (prefix_nal_svc_t*) calloc(1, sizeof(prefix_nal_svc_t));
-    
-    // initialize tables
-    for ( int i = 0; i < 32; i++ ) { h->sps_table[i] = (sps_t*)calloc(1, sizeof(sps_t)); }
-    for ( int i = 0; i < 64; i++ )
-    {
-        h->sps_subset_table[i] = (sps_subset_t*)calloc(1, sizeof(sps_subset_t));
-        h->sps_subset_table[i]->sps = (sps_t*)calloc(1, sizeof(sps_t));
-        h->sps_subset_table[i]->sps_svc_ext = (sps_svc_ext_t*) calloc(1, sizeof(sps_svc_ext_t));
-    }
-    for ( int i = 0; i < 256; i++ ) { h->pps_table[i] = (pps_t*)calloc(1, sizeof(pps_t)); }
 
-    h->sps = (sps_t*)calloc(1, sizeof(sps_t));
-    h->sps_subset = (sps_subset_t*)calloc(1, sizeof(sps_subset_t));
-    h->sps_subset->sps = (sps_t*)calloc(1, sizeof(sps_t));
-    h->sps_subset->sps_svc_ext = (sps_svc_ext_t*)calloc(1, sizeof(sps_svc_ext_t));
-    h->pps = (pps_t*)calloc(1, sizeof(pps_t));
+    // the parameter set tables are all NULL, see h264_sps_table_entry
+
+    h->sps_buf = (sps_t*)calloc(1, sizeof(sps_t));
+    h->sps_subset_buf = (sps_subset_t*)calloc(1, sizeof(sps_subset_t));
+    h->sps_subset_buf->sps = (sps_t*)calloc(1, sizeof(sps_t));
+    h->sps_subset_buf->sps_svc_ext = (sps_svc_ext_t*)calloc(1, sizeof(sps_svc_ext_t));
+    h->pps_buf = (pps_t*)calloc(1, sizeof(pps_t));
+    h->sps = h->sps_buf;
+    h->sps_subset = h->sps_subset_buf;
+    h->pps = h->pps_buf;
     h->aud = (aud_t*)calloc(1, sizeof(aud_t));
     h->num_seis = 0;
+    h->seis_capacity = 0;
     h->seis = NULL;
     h->sei = NULL;  //This is a TEMP pointer at whats in h->seis...
     h->sh = (slice_header_t*)calloc(1, sizeof(slice_header_t));
@@ -77,106 +97,677 @@ void h264_free(h264_stream_t* h)
     free(h->nal->prefix_nal_svc);
     free(h->nal);
 
-    for ( int i = 0; i < 32; i++ ) { free( h->sps_table[i] ); }
+    for ( int i = 0; i < 32; i++ )
+    {
+        if( h->sps_table[i] == NULL ) { continue; }
+        if( h->ps_store != NULL ) { h264_ps_store_release(h->ps_store, h->sps_table[i]); } else { free( h->sps_table[i] ); }
+    }
     for ( int i = 0; i < 64; i++ )
     {
-        if( h->sps_subset_table[i]->sps != NULL )
-            free( h->sps_subset_table[i]->sps );
-        if( h->sps_subset_table[i]->sps_svc_ext != NULL )
-            free( h->sps_subset_table[i]->sps_svc_ext );
+        if( h->sps_subset_table[i] == NULL ) { continue; }
+        free( h->sps_subset_table[i]->sps );
+        free( h->sps_subset_table[i]->sps_svc_ext );
         free( h->sps_subset_table[i] );
     }
-    for ( int i = 0; i < 256; i++ ) { free( h->pps_table[i] ); }
+    for ( int i = 0; i < 256; i++ )
+    {
+        if( h->pps_table[i] == NULL ) { continue; }
+        if( h->ps_store != NULL ) { h264_ps_store_release(h->ps_store, h->pps_table[i]); } else { free( h->pps_table[i] ); }
+    }
 
-    free(h->pps);
+    free(h->pps_buf);
     free(h->aud);
     if(h->seis != NULL)
     {
-        for( int i = 0; i < h->num_seis; i++ )
+        for( int i = 0; i < h->num_seis || i < h->seis_capacity; i++ )
         {
             sei_t* sei = h->seis[i];
-            sei_free(sei);
+            if( sei != NULL ) { sei_free(sei); }
         }
         free(h->seis);
     }
+    h264_arena_free(&h->arena);
     free(h->sh);
     
     if (h->sh_svc_ext != NULL) free(h->sh_svc_ext);
 
     if (h->slice_data != NULL)
     {
-        if (h->slice_data->rbsp_buf != NULL)
+        free(h->slice_data);
+    }
+
+    free(h->sps_buf);
+
+    free(h->sps_subset_buf->sps);
+    free(h->sps_subset_buf->sps_svc_ext);
+    free(h->sps_subset_buf);
+
+    free(h);
+}
+
+/**
+ Keep the SPS and PPS of a stream in a store which other streams may share, rather than in copies of its own.
+ Must be called before any SPS or PPS is read into or stored in the stream, and the store must outlive it.
+ The parameter sets in the tables, and h->sps and h->pps once a slice has been read, are then shared, and must not
+ be modified.
+ @return    0 on success, -1 if the stream already has parameter sets
+ */
+int h264_set_ps_store(h264_stream_t* h, h264_ps_store_t* store)
+{
+    for ( int i = 0; i < 32; i++ ) { if( h->sps_table[i] != NULL ) { return -1; } }
+    for ( int i = 0; i < 256; i++ ) { if( h->pps_table[i] != NULL ) { return -1; } }
+    h->ps_store = store;
+    return 0;
+}
+
+// alignment of the allocations from an arena
+#define H264_ARENA_ALIGN 16
+
+/**
+ Allocate memory from an arena, valid until the next h264_arena_reset.  It is not zeroed.
+ @return    the memory, aligned to H264_ARENA_ALIGN
+ */
+void* h264_arena_alloc(h264_arena_t* a, size_t size)
+{
+    size = (size + H264_ARENA_ALIGN - 1) & ~(size_t)(H264_ARENA_ALIGN - 1);
+    if ( a->used + size <= a->size )
+    {
+        void* p = a->buf + a->used;
+        a->used += size;
+        return p;
+    }
+
+    // does not fit, use a block of its own until the next reset
+    uint8_t* block = (uint8_t*)malloc(H264_ARENA_ALIGN + size);
+    *(void**)block = a->extra;
+    a->extra = block;
+    a->used += size;
+    return block + H264_ARENA_ALIGN;
+}
+
+/**
+ Release everything allocated from an arena.  If that did not all fit in the arena's block, the block is replaced
+ by one which would have held it.
+ */
+void h264_arena_reset(h264_arena_t* a)
+{
+    if ( a->extra != NULL )
+    {
+        while ( a->extra != NULL )
         {
-            free(h->slice_data->rbsp_buf);
+            void* next = *(void**)a->extra;
+            free(a->extra);
+            a->extra = next;
         }
+        free(a->buf);
+        a->size = ( a->used > 2 * a->size ) ? a->used : 2 * a->size;
+        a->buf = (uint8_t*)malloc(a->size);
+    }
+    a->used = 0;
+}
 
-        free(h->slice_data);
+/**
+ Free all memory held by an arena.  The arena itself is not freed, and may be used again.
+ */
+void h264_arena_free(h264_arena_t* a)
+{
+    h264_arena_reset(a);
+    free(a->buf);
+    a->buf = NULL;
+    a->size = 0;
+}
+
+/**
+ Get the entry of the SPS table for an id, allocating it (all zeros) if no SPS with that id has been seen yet.
+ @return    the entry, or NULL if the id is out of range or the stream uses a parameter set store
+ */
+sps_t* h264_sps_table_entry(h264_stream_t* h, int id)
+{
+    if ( id < 0 || id >= 32 || h->ps_store != NULL ) { return NULL; }
+    if ( h->sps_table[id] == NULL ) { h->sps_table[id] = (sps_t*)calloc(1, sizeof(sps_t)); }
+    return h->sps_table[id];
+}
+
+/**
+ Get the entry of the subset SPS table for an id, as h264_sps_table_entry.
+ */
+sps_subset_t* h264_sps_subset_table_entry(h264_stream_t* h, int id)
+{
+    if ( id < 0 || id >= 64 ) { return NULL; }
+    if ( h->sps_subset_table[id] == NULL )
+    {
+        h->sps_subset_table[id] = (sps_subset_t*)calloc(1, sizeof(sps_subset_t));
+        h->sps_subset_table[id]->sps = (sps_t*)calloc(1, sizeof(sps_t));
+        h->sps_subset_table[id]->sps_svc_ext = (sps_svc_ext_t*)calloc(1, sizeof(sps_svc_ext_t));
     }
+    return h->sps_subset_table[id];
+}
 
-    free(h->sps);
+/**
+ Get the entry of the PPS table for an id, as h264_sps_table_entry.
+ */
+pps_t* h264_pps_table_entry(h264_stream_t* h, int id)
+{
+    if ( id < 0 || id >= 256 || h->ps_store != NULL ) { return NULL; }
+    if ( h->pps_table[id] == NULL ) { h->pps_table[id] = (pps_t*)calloc(1, sizeof(pps_t)); }
+    return h->pps_table[id];
+}
 
-    free(h->sps_subset->sps);
-    free(h->sps_subset->sps_svc_ext);
-    free(h->sps_subset);
+/**
+ Store an SPS in the SPS table under its id, replacing any SPS stored with that id before.  With a parameter set
+ store the entry is a reference to the store's copy, otherwise a copy of the stream's own.
+ @return    the entry, or NULL if the id is out of range
+ */
+sps_t* h264_sps_table_put(h264_stream_t* h, const sps_t* sps)
+{
+    int id = sps->seq_parameter_set_id;
+    if ( id < 0 || id >= 32 ) { return NULL; }
+    if ( h->ps_store == NULL )
+    {
+        sps_t* entry = h264_sps_table_entry(h, id);
+        memcpy(entry, sps, sizeof(sps_t));
+        return entry;
+    }
 
-    free(h);
+    sps_t* shared = h264_ps_store_intern_sps(h->ps_store, sps);
+    if ( h->sps_table[id] != NULL ) { h264_ps_store_release(h->ps_store, h->sps_table[id]); }
+    h->sps_table[id] = shared;
+    return shared;
+}
+
+/**
+ Store a PPS in the PPS table under its id, as h264_sps_table_put.
+ */
+pps_t* h264_pps_table_put(h264_stream_t* h, const pps_t* pps)
+{
+    int id = pps->pic_parameter_set_id;
+    if ( id < 0 || id >= 256 ) { return NULL; }
+    if ( h->ps_store == NULL )
+    {
+        pps_t* entry = h264_pps_table_entry(h, id);
+        memcpy(entry, pps, sizeof(pps_t));
+        return entry;
+    }
+
+    pps_t* shared = h264_ps_store_intern_pps(h->ps_store, pps);
+    if ( h->pps_table[id] != NULL ) { h264_ps_store_release(h->ps_store, h->pps_table[id]); }
+    h->pps_table[id] = shared;
+    return shared;
+}
+
+/**
+ Find the SPS with an id among those seen so far.
+ @return    the SPS, or NULL if there is none or the id is out of range
+ */
+sps_t* h264_sps_table_find(h264_stream_t* h, int id)
+{
+    return ( id >= 0 && id < 32 ) ? h->sps_table[id] : NULL;
+}
+
+/**
+ Find the subset SPS with an id among those seen so far, as h264_sps_table_find.
+ */
+sps_subset_t* h264_sps_subset_table_find(h264_stream_t* h, int id)
+{
+    return ( id >= 0 && id < 64 ) ? h->sps_subset_table[id] : NULL;
+}
+
+/**
+ Find the PPS with an id among those seen so far, as h264_sps_table_find.
+ */
+pps_t* h264_pps_table_find(h264_stream_t* h, int id)
+{
+    return ( id >= 0 && id < 256 ) ? h->pps_table[id] : NULL;
+}
+
+/**
+ Make the PPS with an id the active one, h->pps.  That points at the table entry, or if there is none at
+ h->pps_buf cleared to all zeros.
+ */
+void h264_activate_pps(h264_stream_t* h, int id)
+{
+    pps_t* pps = h264_pps_table_find(h, id);
+    if ( pps == NULL )
+    {
+        pps = h->pps_buf;
+        memset(pps, 0, sizeof(pps_t));
+    }
+    h->pps = pps;
+}
+
+/**
+ Make the SPS with an id the active one, h->sps, as h264_activate_pps.
+ */
+void h264_activate_sps(h264_stream_t* h, int id)
+{
+    sps_t* sps = h264_sps_table_find(h, id);
+    if ( sps == NULL )
+    {
+        sps = h->sps_buf;
+        memset(sps, 0, sizeof(sps_t));
+    }
+    h->sps = sps;
+}
+
+/**
+ Make the subset SPS with an id the active one, h->sps_subset, as h264_activate_pps.
+ */
+void h264_activate_sps_subset(h264_stream_t* h, int id)
+{
+    sps_subset_t* sps_subset = h264_sps_subset_table_find(h, id);
+    if ( sps_subset == NULL )
+    {
+        sps_subset = h->sps_subset_buf;
+        memset(sps_subset->sps, 0, sizeof(sps_t));
+        memset(sps_subset->sps_svc_ext, 0, sizeof(sps_svc_ext_t));
+        sps_subset->additional_extension2_flag = 0;
+    }
+    h->sps_subset = sps_subset;
+}
+
+/**
+ Clear a slice header before reading the next one into it.  The tables at its end are only cleared if the last slice
+ header filled them, which saves clearing several kilobytes for a typical slice.
+ */
+void h264_slice_header_clear(slice_header_t* sh)
+{
+    if ( sh->pwt_read ) { memset(&sh->pwt, 0, sizeof(sh->pwt)); }
+    if ( sh->rplr.ref_pic_list_reordering_flag_l0 || sh->rplr.ref_pic_list_reordering_flag_l1 )
+    {
+        memset(&sh->rplr, 0, sizeof(sh->rplr));
+    }
+    if ( sh->drpm.no_output_of_prior_pics_flag || sh->drpm.long_term_reference_flag ||
+         sh->drpm.adaptive_ref_pic_marking_mode_flag )
+    {
+        memset(&sh->drpm, 0, sizeof(sh->drpm));
+    }
+    memset(sh, 0, offsetof(slice_header_t, pwt));
+}
+
+/**
+ Find the first i >= from such that buf[i] == 0, buf[i+1] == 0 and (buf[i+2] & mask) == val, with all three bytes
+ before size.  Scans 32 (AVX2) or 16 (SSE2) positions at a time, then finishes byte by byte.
+ @return  the position, or -1 if there is none
+ */
+int64_t find_zero_pair64(const uint8_t* buf, int64_t from, int64_t size, uint8_t mask, uint8_t val)
+{
+    int64_t i = from;
+
+#if defined(__AVX2__)
+    const __m256i vzero = _mm256_setzero_si256();
+    const __m256i vmask = _mm256_set1_epi8((char)mask);
+    const __m256i vval = _mm256_set1_epi8((char)val);
+    for ( ; i + 34 <= size; i += 32)
+    {
+        __m256i z0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i)), vzero);
+        __m256i z1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i + 1)), vzero);
+        __m256i x2 = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(buf + i + 2)), vmask), vval);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(z0, z1), x2));
+        if (m != 0) { return i + __builtin_ctz(m); }
+    }
+#elif defined(__SSE2__)
+    const __m128i vzero = _mm_setzero_si128();
+    const __m128i vmask = _mm_set1_epi8((char)mask);
+    const __m128i vval = _mm_set1_epi8((char)val);
+    for ( ; i + 18 <= size; i += 16)
+    {
+        __m128i z0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i)), vzero);
+        __m128i z1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 1)), vzero);
+        __m128i x2 = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i*)(buf + i + 2)), vmask), vval);
+        uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(z0, z1), x2));
+        if (m != 0) { return i + __builtin_ctz(m); }
+    }
+#endif
+
+    while (i + 3 <= size)
+    {
+        // a nonzero third byte which does not match rules out a code starting at i, i+1 or i+2
+        if (buf[i+2] != 0 && (buf[i+2] & mask) != val) { i += 3; continue; }
+        if (buf[i] == 0 && buf[i+1] == 0 && (buf[i+2] & mask) == val) { return i; }
+        i++;
+    }
+    return -1;
+}
+
+/**
+ As find_zero_pair64, for buffers smaller than 2 GB.
+ */
+int find_zero_pair(const uint8_t* buf, int from, int size, uint8_t mask, uint8_t val)
+{
+    return (int)find_zero_pair64(buf, from, size, mask, val);
+}
+
+// first 00 00 01, or 00 00 00/01 if zero_ok, at or after from; -1 if there is none
+static int64_t find_start_code(const uint8_t* buf, int64_t from, int64_t size, int zero_ok)
+{
+    return zero_ok ? find_zero_pair64(buf, from, size, 0xFE, 0x00) : find_zero_pair64(buf, from, size, 0xFF, 0x01);
 }
 
 /**
  Find the beginning and end of a NAL (Network Abstraction Layer) unit in a byte buffer containing H264 bitstream data.
+ The NAL starts after the first 00 00 01 (which may be part of a 00 00 00 01) and ends before the next 00 00 00 or 00 00 01.
+ If there is no end before the end of the buffer, *nal_end is set to size and -1 is returned; when no more data follows,
+ the NAL runs to the end of the buffer.
  @param[in]   buf        the buffer
  @param[in]   size       the size of the buffer
  @param[out]  nal_start  the beginning offset of the nal
  @param[out]  nal_end    the end offset of the nal
  @return                 the length of the nal, or 0 if did not find start of nal, or -1 if did not find end of nal
  */
-// DEPRECATED - this will be replaced by a similar function with a slightly different API
-int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end)
+int64_t find_nal_unit64(uint8_t* buf, int64_t size, int64_t* nal_start, int64_t* nal_end)
 {
-    int i;
-    // find start
+    int64_t i;
     *nal_start = 0;
     *nal_end = 0;
-    
-    i = 0;
-    while (   //( next_bits( 24 ) != 0x000001 && next_bits( 32 ) != 0x00000001 )
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) && 
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0 || buf[i+3] != 0x01) 
-        )
+
+    // find start
+    i = find_start_code(buf, 0, size, 0);
+    if (i < 0) { return 0; } // did not find nal start
+    *nal_start = i + 3;
+
+    // find end
+    i = find_start_code(buf, *nal_start, size, 1);
+    if (i < 0) { *nal_end = size; return -1; } // did not find nal end, stream ended first
+
+    *nal_end = i;
+    return (*nal_end - *nal_start);
+}
+
+/**
+ As find_nal_unit64, for buffers smaller than 2 GB.
+ */
+// DEPRECATED - this will be replaced by a similar function with a slightly different API
+int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end)
+{
+    int64_t start, end;
+    int rc = (int)find_nal_unit64(buf, size, &start, &end);
+    *nal_start = (int)start;
+    *nal_end = (int)end;
+    return rc;
+}
+
+
+/**
+ Create a streaming NAL splitter.
+ @param[in]   callback   called with each NAL found
+ @param[in]   opaque     passed to the callback
+ @return                 the splitter
+ */
+nal_splitter_t* nal_splitter_new(nal_splitter_callback_t callback, void* opaque)
+{
+    nal_splitter_t* s = (nal_splitter_t*)calloc(1, sizeof(nal_splitter_t));
+    s->callback = callback;
+    s->opaque = opaque;
+    return s;
+}
+
+/**
+ Free a NAL splitter.  Any unfinished NAL is dropped, call nal_splitter_finish first to get it.
+ */
+void nal_splitter_free(nal_splitter_t* s)
+{
+    if (s->buf != NULL) { free(s->buf); }
+    free(s);
+}
+
+// stream offset of the first code at or after from, as for find_start_code, where the chunk data starts at s->offset
+// and the s->zeros bytes before it are 00; -1 if there is none which is complete
+static int64_t nal_splitter_find(nal_splitter_t* s, const uint8_t* data, int64_t size, int64_t from, int zero_ok)
+{
+    int64_t q;
+    int64_t i;
+
+    // codes which begin in the zeros at the end of the previous chunk
+    for (q = from; q < s->offset; q++)
     {
-        i++; // skip leading zero
-        if (i+4 >= size) { return 0; } // did not find nal start
+        int before = (int)(s->offset - q); // bytes of the code before the chunk
+        if (before > s->zeros) { continue; }
+        if (size < 3 - before) { break; }
+        if (before == 1 && data[0] != 0) { continue; }
+        if (data[2 - before] == 1 || (zero_ok && data[2 - before] == 0)) { return q; }
     }
 
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) // ( next_bits( 24 ) != 0x000001 )
+    i = find_start_code(data, (from > s->offset) ? from - s->offset : 0, size, zero_ok);
+    if (i < 0) { return -1; }
+    return s->offset + i;
+}
+
+// pass the NAL which started at s->nal_offset and ends at stream offset nal_end to the callback
+static int nal_splitter_emit(nal_splitter_t* s, uint8_t* data, int64_t nal_end)
+{
+    int size = (int)(nal_end - s->nal_offset);
+    int rc = 0;
+
+    if (size <= 0) { s->size = 0; return 0; }
+
+    if (s->nal_offset >= s->offset)
     {
-        i++;
+        // all in this chunk
+        rc = s->callback(s->opaque, s->nal_offset, data + (s->nal_offset - s->offset), size);
+    }
+    else
+    {
+        // the start is in s->buf; if the end code began in the previous chunk, size is less than s->size
+        if (nal_end > s->offset)
+        {
+            int n = (int)(nal_end - s->offset);
+            if (s->size + n > s->capacity)
+            {
+                s->capacity = (s->size + n) * 2;
+                s->buf = (uint8_t*)realloc(s->buf, s->capacity);
+            }
+            memcpy(s->buf + s->size, data, n);
+        }
+        rc = s->callback(s->opaque, s->nal_offset, s->buf, size);
     }
 
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) { /* error, should never happen */ return 0; }
-    i+= 3;
-    *nal_start = i;
-    
-    while (   //( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0) && 
-        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) 
-        )
+    s->size = 0;
+    return rc;
+}
+
+/**
+ Feed the next chunk of an Annex B byte stream to a NAL splitter.  Each NAL which is complete once this chunk
+ is added is passed to the callback, in order.  A NAL ends at the next 00 00 00 or 00 00 01, as in find_nal_unit;
+ empty NALs are skipped.  Bytes are searched only once, whatever the chunk sizes.
+ @param[in]   s          the splitter
+ @param[in]   data       the chunk
+ @param[in]   size       the size of the chunk, which may be 2 GB or more; each NAL must be smaller than that
+ @return                 0, or the nonzero value returned by the callback, in which case the rest of the chunk is dropped
+ */
+int nal_splitter_push64(nal_splitter_t* s, uint8_t* data, int64_t size)
+{
+    int64_t end = s->offset + size;
+    int64_t q;
+    int rc = 0;
+    int z;
+
+    while ((q = nal_splitter_find(s, data, size, s->scan, s->in_nal)) >= 0)
     {
-        i++;
-        // FIXME the next line fails when reading a nal that ends exactly at the end of the data
-        if (i+3 >= size) { *nal_end = size; return -1; } // did not find nal end, stream ended first
+        if (! s->in_nal)
+        {
+            s->in_nal = 1;
+            s->nal_offset = q + 3;
+            s->size = 0;
+            s->scan = q + 3;
+        }
+        else
+        {
+            rc = nal_splitter_emit(s, data, q);
+            s->in_nal = 0;
+            s->scan = q; // the end code may be the next start code
+            if (rc != 0) { break; }
+        }
     }
-    
-    *nal_end = i;
-    return (*nal_end - *nal_start);
+
+    if (rc != 0)
+    {
+        s->scan = end;
+        s->zeros = 0;
+        s->offset = end;
+        return rc;
+    }
+
+    // keep the part of the unfinished NAL which is in this chunk
+    if (s->in_nal)
+    {
+        int64_t from = (s->nal_offset > s->offset) ? s->nal_offset - s->offset : 0;
+        int n = (int)(size - from);
+        if (n > 0)
+        {
+            if (s->size + n > s->capacity)
+            {
+                s->capacity = (s->size + n) * 2;
+                s->buf = (uint8_t*)realloc(s->buf, s->capacity);
+            }
+            memcpy(s->buf + s->size, data + from, n);
+            s->size += n;
+        }
+    }
+
+    // the last two positions need bytes from the next chunk
+    if (s->scan < end - 2) { s->scan = end - 2; }
+
+    for (z = 0; z < 2 && z < size && data[size - 1 - z] == 0; z++) { }
+    if (z == size) { z += s->zeros; if (z > 2) { z = 2; } }
+    s->zeros = z;
+    s->offset = end;
+
+    return 0;
 }
 
+/**
+ As nal_splitter_push64, for chunks smaller than 2 GB.
+ */
+int nal_splitter_push(nal_splitter_t* s, uint8_t* data, int size)
+{
+    return nal_splitter_push64(s, data, size);
+}
+
+/**
+ Signal the end of the stream to a NAL splitter.  The NAL after the last start code, which has no end code,
+ is passed to the callback, without any trailing zero bytes.
+ @return                 0, or the nonzero value returned by the callback
+ */
+int nal_splitter_finish(nal_splitter_t* s)
+{
+    int rc = 0;
+
+    if (s->in_nal)
+    {
+        int size = s->size;
+        while (size > 0 && s->buf[size - 1] == 0) { size--; } // trailing_zero_8bits
+        if (size > 0) { rc = s->callback(s->opaque, s->nal_offset, s->buf, size); }
+    }
+
+    s->in_nal = 0;
+    s->size = 0;
+    return rc;
+}
+
+#ifdef HAVE_MMAP
+// push the rest of a regular file from a mapping of it, and finish; returns 0 if it cannot be mapped, else 1 with
+// the result in *rc
+static int nal_splitter_push_mapped(nal_splitter_t* s, FILE* f, int* rc)
+{
+    struct stat st;
+    long pos = ftell(f);
+    uint8_t* map;
+
+    if (pos < 0 || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= (off_t)pos) { return 0; }
+    if ((uint64_t)st.st_size > (uint64_t)(size_t)-1) { return 0; }
+
+    map = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map == (uint8_t*)MAP_FAILED) { return 0; }
+
+    // the scan reads each page once, front to back: read ahead aggressively, and use huge pages if the kernel can
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise(map, (size_t)st.st_size, MADV_HUGEPAGE);
+#endif
+
+    *rc = nal_splitter_push64(s, map + pos, (int64_t)st.st_size - pos);
+    if (*rc == 0) { *rc = nal_splitter_finish(s); }
+
+    munmap(map, (size_t)st.st_size);
+    fseek(f, 0, SEEK_END);
+    return 1;
+}
+#endif
+
+/**
+ Feed the rest of a file to a NAL splitter, then finish it.  A regular file is mapped and pushed in place, so none of
+ it is copied except the last NAL; anything else, such as a pipe, is read in chunks.
+ @param[in]   s          the splitter
+ @param[in]   f          the file, open for reading
+ @return                 0, the nonzero value returned by the callback, or -1 on a read error
+ */
+int nal_splitter_push_file(nal_splitter_t* s, FILE* f)
+{
+    uint8_t* buf;
+    int rc = 0;
+
+#ifdef HAVE_MMAP
+    if (nal_splitter_push_mapped(s, f, &rc)) { return rc; }
+#endif
+
+    buf = (uint8_t*)malloc(NAL_SPLITTER_READ_SIZE);
+    while (rc == 0)
+    {
+        size_t n = fread(buf, 1, NAL_SPLITTER_READ_SIZE, f);
+        if (n == 0)
+        {
+            if (ferror(f)) { rc = -1; break; }
+            rc = nal_splitter_finish(s);
+            break;
+        }
+        rc = nal_splitter_push(s, buf, (int)n);
+    }
+    free(buf);
+
+    return rc;
+}
+
+/**
+   Find the size of the NAL data (Annex B format) which rbsp_to_nal produces from some RBSP data,
+   i.e. rbsp_size plus the number of emulation prevention bytes plus one.  Scans for 00 00 0x 16 or 32 bytes at a time.
+   @param[in] rbsp_buf   the rbsp data
+   @param[in] rbsp_size  the size of the rbsp data
+   @return  the exact size of nal data needed
+ */
+int64_t rbsp_to_nal_size64(const uint8_t* rbsp_buf, int64_t rbsp_size)
+{
+    int64_t i = 0;
+    int64_t k;
+    int64_t count = 0;
+
+    // an emulation prevention byte goes before every third byte <= 3 of a 00 00 xx, counting after the previous one
+    while ((k = find_zero_pair64(rbsp_buf, i, rbsp_size, 0xFC, 0x00)) >= 0)
+    {
+        count++;
+        i = k + 2;
+    }
+
+    return rbsp_size + count + 1;
+}
+
+/**
+   As rbsp_to_nal_size64, for data smaller than 2 GB.
+ */
+int rbsp_to_nal_size(const uint8_t* rbsp_buf, int rbsp_size)
+{
+    return (int)rbsp_to_nal_size64(rbsp_buf, rbsp_size);
+}
 
 /**
    Convert RBSP data to NAL data (Annex B format).
-   The size of nal_buf must be 3/2 * the size of the rbsp_buf (rounded up) to guarantee the output will fit.
-   If that is not true, output may be truncated and an error will be returned.
+   The size of nal_buf must be rbsp_to_nal_size(rbsp_buf, *rbsp_size) (at most 3/2 * the size of the rbsp_buf, rounded up, plus 1)
+   to guarantee the output will fit.
+   If that is not true, nothing is written and an error is returned.
    If that is true, there is no possible error during this conversion.
+   The conversion may be done in place: rbsp_buf may lie within nal_buf, as long as it starts at least
+   rbsp_to_nal_size(rbsp_buf, *rbsp_size) - *rbsp_size bytes after nal_buf.
    @param[in] rbsp_buf   the rbsp data
    @param[in] rbsp_size  pointer to the size of the rbsp data
    @param[in,out] nal_buf   allocated memory in which to put the nal data
@@ -185,46 +776,49 @@ int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end)
  */
 // 7.3.1 NAL unit syntax
 // 7.4.1.1 Encapsulation of an SODB within an RBSP
-int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size)
+int64_t rbsp_to_nal64(const uint8_t* rbsp_buf, const int64_t* rbsp_size, uint8_t* nal_buf, int64_t* nal_size)
 {
-    int i;
-    int j     = 1;
-    int count = 0;
+    int64_t i = 0;
+    int64_t j = 1;
+    int64_t k;
+
+    if ( *rbsp_size > 0 && rbsp_to_nal_size64(rbsp_buf, *rbsp_size) > *nal_size )
+    {
+        // error, not enough space
+        return -1;
+    }
 
     if (*nal_size > 0) { nal_buf[0] = 0x00; } // zero out first byte since we start writing from second byte
 
-    for ( i = 0; i < *rbsp_size ; )
+    // copy everything up to each 00 00 which needs an emulation prevention byte as is; memmove, as the output may
+    // overlap the input, but only before the bytes which are yet to be read
+    while ((k = find_zero_pair64(rbsp_buf, i, *rbsp_size, 0xFC, 0x00)) >= 0)
     {
-        if ( j >= *nal_size ) 
-        {
-            // error, not enough space
-            return -1;
-        }
-
-        if ( ( count == 2 ) && !(rbsp_buf[i] & 0xFC) ) // HACK 0xFC
-        {
-            nal_buf[j] = 0x03;
-            j++;
-            count = 0;
-            continue;
-        }
-        nal_buf[j] = rbsp_buf[i];
-        if ( rbsp_buf[i] == 0x00 )
-        {
-            count++;
-        }
-        else
-        {
-            count = 0;
-        }
-        i++;
+        memmove(nal_buf + j, rbsp_buf + i, k + 2 - i);
+        j += k + 2 - i;
+        nal_buf[j] = 0x03;
         j++;
+        i = k + 2;
     }
+    memmove(nal_buf + j, rbsp_buf + i, *rbsp_size - i);
+    j += *rbsp_size - i;
 
     *nal_size = j;
     return j;
 }
 
+/**
+   As rbsp_to_nal64, for data smaller than 2 GB.
+ */
+int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size)
+{
+    int64_t rbsp_size64 = *rbsp_size;
+    int64_t nal_size64 = *nal_size;
+    int rc = (int)rbsp_to_nal64(rbsp_buf, &rbsp_size64, nal_buf, &nal_size64);
+    *nal_size = (int)nal_size64;
+    return rc;
+}
+
 /**
    Convert NAL data (Annex B format) to RBSP data.
    The size of rbsp_buf must be the same as size of the nal_buf to guarantee the output will fit.
@@ -238,14 +832,26 @@ int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf,
  */
 // 7.3.1 NAL unit syntax
 // 7.4.1.1 Encapsulation of an SODB within an RBSP
-int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size)
+int64_t nal_to_rbsp64(const uint8_t* nal_buf, int64_t* nal_size, uint8_t* rbsp_buf, int64_t* rbsp_size)
 {
-    int i;
-    int j     = 0;
+    int64_t i;
+    int64_t j = 0;
     int count = 0;
   
     for( i = 0; i < *nal_size; i++ )
     { 
+        // only 00 00 00/01/02/03 needs the checks below, copy everything before the next one as is
+        if( count == 0 )
+        {
+            int64_t k = find_zero_pair64(nal_buf, i, *nal_size, 0xFC, 0x00);
+            int64_t n = ( k < 0 ? *nal_size : k ) - i;
+            if( n > *rbsp_size - j ) { n = *rbsp_size - j; }
+            memcpy(rbsp_buf + j, nal_buf + i, n);
+            i += n;
+            j += n;
+            if( i == *nal_size ) { break; }
+        }
+
         // in NAL unit, 0x000000, 0x000001 or 0x000002 shall not occur at any byte-aligned position
         if( ( count == 2 ) && ( nal_buf[i] < 0x03) ) 
         {
@@ -293,6 +899,19 @@ int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* r
     return j;
 }
 
+/**
+   As nal_to_rbsp64, for data smaller than 2 GB.
+ */
+int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size)
+{
+    int64_t nal_size64 = *nal_size;
+    int64_t rbsp_size64 = *rbsp_size;
+    int rc = (int)nal_to_rbsp64(nal_buf, &nal_size64, rbsp_buf, &rbsp_size64);
+    *nal_size = (int)nal_size64;
+    *rbsp_size = (int)rbsp_size64;
+    return rc;
+}
+
 
 /**
  Read only the NAL headers (enough to determine unit type) from a byte buffer.
@@ -302,14 +921,13 @@ int peek_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 {
     nal_t* nal = h->nal;
 
-    bs_t* b = bs_new(buf, size);
+    bs_t bs;
+    bs_t* b = bs_init(&bs, buf, size);
 
     nal->forbidden_zero_bit = bs_read_f(b,1);
     nal->nal_ref_idc = bs_read_u(b,2);
     nal->nal_unit_type = bs_read_u(b,5);
 
-    bs_free(b);
-
     // basic verification, per 7.4.1
     if ( nal->forbidden_zero_bit ) { return -1; }
     if ( nal->nal_unit_type <= 0 || nal->nal_unit_type > 20 ) { return -1; }
@@ -337,4 +955,187 @@ int peek_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
     return nal->nal_unit_type;
 }
 
+/**
+ Read a NAL as read_nal_unit does, except that of a coded slice only the slice header is read.  The slice data is
+ not converted to RBSP or copied, so this costs about the same for any size of slice.
+ @return  the size of the NAL, or -1 on error
+*/
+int read_nal_unit_headers(h264_stream_t* h, uint8_t* buf, int size)
+{
+    nal_t* nal = h->nal;
+    int nal_unit_type = (size > 0) ? (buf[0] & 0x1F) : 0;
+    uint8_t* rbsp_buf;
+    bs_t bs;
+    bs_t* b;
+
+    if ( nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_IDR &&
+         nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+         nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_AUX )
+    {
+        return read_nal_unit(h, buf, size);
+    }
 
+    // the RBSP is produced as the parser reads it, so only the bytes of the header are converted
+    h264_arena_reset(&h->arena);
+    h->slice_data->rbsp_buf = NULL;
+    h->slice_data->rbsp_size = 0;
+    rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, size + BS_PADDING);
+    b = bs_init_nal(&bs, rbsp_buf, buf, size);
+
+    nal->forbidden_zero_bit = bs_read_f(b, 1);
+    nal->nal_ref_idc = bs_read_u(b, 2);
+    nal->nal_unit_type = bs_read_u(b, 5);
+
+    read_slice_header(h, b);
+    return bs_error(b) ? -1 : size;
+}
+
+// 7.4.1.2.4 Detection of the first VCL NAL unit of a primary coded picture
+static int au_detector_new_picture(au_detector_t* d, h264_stream_t* h)
+{
+    slice_header_t* sh = h->sh;
+    int idr_pic_flag = (h->nal->nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR);
+
+    if ( sh->frame_num != d->frame_num ) { return 1; }
+    if ( sh->pic_parameter_set_id != d->pic_parameter_set_id ) { return 1; }
+    if ( sh->field_pic_flag != d->field_pic_flag ) { return 1; }
+    if ( sh->field_pic_flag && sh->bottom_field_flag != d->bottom_field_flag ) { return 1; }
+    if ( (h->nal->nal_ref_idc == 0) != (d->nal_ref_idc == 0) ) { return 1; }
+    if ( h->sps->pic_order_cnt_type == 0 && d->pic_order_cnt_type == 0 &&
+         ( sh->pic_order_cnt_lsb != d->pic_order_cnt_lsb ||
+           sh->delta_pic_order_cnt_bottom != d->delta_pic_order_cnt_bottom ) ) { return 1; }
+    if ( h->sps->pic_order_cnt_type == 1 && d->pic_order_cnt_type == 1 &&
+         ( sh->delta_pic_order_cnt[0] != d->delta_pic_order_cnt[0] ||
+           sh->delta_pic_order_cnt[1] != d->delta_pic_order_cnt[1] ) ) { return 1; }
+    if ( idr_pic_flag != d->idr_pic_flag ) { return 1; }
+    if ( idr_pic_flag && sh->idr_pic_id != d->idr_pic_id ) { return 1; }
+
+    return 0;
+}
+
+/**
+ Tell whether a NAL starts a new access unit.  Call this for each NAL of a stream in turn, after reading it with
+ read_nal_unit or read_nal_unit_headers.  An access unit starts at an access unit delimiter, at the first SPS, PPS,
+ SEI or NAL of type 14 to 18 after the slices of a primary coded picture, or at the first slice of a new primary
+ coded picture (7.4.1.2.3).
+ @param[in,out]  d   the detector, zeroed before the first NAL
+ @param[in]      h   the stream, holding the headers of the NAL
+ @return             1 if the NAL is the first of an access unit, 0 otherwise
+*/
+int au_detector_push(au_detector_t* d, h264_stream_t* h)
+{
+    int t = h->nal->nal_unit_type;
+    int primary_slice = ( t == NAL_UNIT_TYPE_CODED_SLICE_IDR || t == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR ) &&
+                        h->sh->redundant_pic_cnt == 0;
+    int new_au = ! d->started || d->end_of_seq;
+
+    if ( t == NAL_UNIT_TYPE_AUD ) { new_au = 1; }
+    if ( d->has_vcl && ( t == NAL_UNIT_TYPE_SPS || t == NAL_UNIT_TYPE_PPS || t == NAL_UNIT_TYPE_SEI ||
+                         ( t >= 14 && t <= 18 ) ) ) { new_au = 1; }
+    if ( d->has_vcl && primary_slice && au_detector_new_picture(d, h) ) { new_au = 1; }
+
+    if ( new_au ) { d->has_vcl = 0; }
+
+    if ( primary_slice )
+    {
+        slice_header_t* sh = h->sh;
+        d->has_vcl = 1;
+        d->frame_num = sh->frame_num;
+        d->pic_parameter_set_id = sh->pic_parameter_set_id;
+        d->field_pic_flag = sh->field_pic_flag;
+        d->bottom_field_flag = sh->bottom_field_flag;
+        d->nal_ref_idc = h->nal->nal_ref_idc;
+        d->pic_order_cnt_type = h->sps->pic_order_cnt_type;
+        d->pic_order_cnt_lsb = sh->pic_order_cnt_lsb;
+        d->delta_pic_order_cnt_bottom = sh->delta_pic_order_cnt_bottom;
+        d->delta_pic_order_cnt[0] = sh->delta_pic_order_cnt[0];
+        d->delta_pic_order_cnt[1] = sh->delta_pic_order_cnt[1];
+        d->idr_pic_flag = ( t == NAL_UNIT_TYPE_CODED_SLICE_IDR );
+        d->idr_pic_id = sh->idr_pic_id;
+    }
+
+    d->started = 1;
+    d->end_of_seq = ( t == NAL_UNIT_TYPE_END_OF_SEQUENCE || t == NAL_UNIT_TYPE_END_OF_STREAM );
+
+    return new_au;
+}
+
+/**
+ Create an iterator over the access units of an Annex B byte stream.
+ @param[in]   buf        the stream, which must stay valid while the iterator is used
+ @param[in]   size       the size of the stream
+ @return                 the iterator
+*/
+au_iterator_t* au_iterator_new(uint8_t* buf, int64_t size)
+{
+    au_iterator_t* it = (au_iterator_t*)calloc(1, sizeof(au_iterator_t));
+    it->h = h264_new();
+    it->buf = buf;
+    it->size = size;
+    it->next_offset = -1;
+    return it;
+}
+
+/**
+ Free an access unit iterator.
+*/
+void au_iterator_free(au_iterator_t* it)
+{
+    h264_free(it->h);
+    free(it);
+}
+
+/**
+ Find the next access unit.  NALs are found as by find_nal_unit.
+ @param[in]   it         the iterator
+ @param[out]  au         the access unit
+ @return                 1 if an access unit was found, 0 at the end of the stream
+*/
+int au_iterator_next(au_iterator_t* it, access_unit_t* au)
+{
+    au->offset = 0;
+    au->size = 0;
+    au->num_nals = 0;
+
+    if ( it->next_offset >= 0 )
+    {
+        au->offset = it->next_offset;
+        au->size = it->next_size;
+        au->num_nals = 1;
+        it->next_offset = -1;
+    }
+
+    while ( it->pos < it->size )
+    {
+        int64_t nal_start, nal_end;
+        int64_t rc = find_nal_unit64(it->buf + it->pos, it->size - it->pos, &nal_start, &nal_end);
+        int64_t offset = it->pos + nal_start;
+        int64_t size = nal_end - nal_start;
+
+        if ( rc == 0 && nal_start == 0 ) { it->pos = it->size; break; } // no more start codes
+        it->pos += nal_end;
+
+        // the last NAL has no end code, and runs to the end of the stream less trailing_zero_8bits
+        if ( rc < 0 && it->pos == it->size ) { while ( size > 0 && it->buf[offset + size - 1] == 0x00 ) { size--; } }
+        if ( size <= 0 ) { continue; }
+
+        // a NAL which cannot be read whole, such as SEI when that is not parsed, still counts with its NAL header
+        // and whatever of the rest was read
+        read_nal_unit_headers(it->h, it->buf + offset, (int)size);
+        it->h->nal->nal_ref_idc = ( it->buf[offset] >> 5 ) & 0x03;
+        it->h->nal->nal_unit_type = it->buf[offset] & 0x1F;
+
+        if ( au_detector_push(&it->d, it->h) && au->num_nals > 0 )
+        {
+            it->next_offset = offset;
+            it->next_size = size;
+            return 1;
+        }
+
+        if ( au->num_nals == 0 ) { au->offset = offset; }
+        au->size = offset + size - au->offset;
+        au->num_nals++;
+    }
+
+    return ( au->num_nals > 0 );
+}
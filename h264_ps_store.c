@@ -0,0 +1,198 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "h264_ps_store.h"
+
+// number of hash buckets; a store rarely holds more than a few parameter sets per stream
+#ifndef PS_STORE_BUCKETS
+#define PS_STORE_BUCKETS 256
+#endif
+
+/*
+ Each parameter set in a store is allocated right after one of these.
+ */
+typedef struct ps_store_entry
+{
+    struct ps_store_entry* next;    // in the same bucket
+    uint64_t hash;
+    int nal_unit_type;              // NAL_UNIT_TYPE_SPS or NAL_UNIT_TYPE_PPS
+    int refs;
+} ps_store_entry_t;
+
+struct h264_ps_store
+{
+    ps_store_entry_t* buckets[PS_STORE_BUCKETS];
+    int num_entries;
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef HAVE_LIBPTHREAD
+#define PS_STORE_LOCK(store)    pthread_mutex_lock(&(store)->lock)
+#define PS_STORE_UNLOCK(store)  pthread_mutex_unlock(&(store)->lock)
+#else
+#define PS_STORE_LOCK(store)
+#define PS_STORE_UNLOCK(store)
+#endif
+
+// 64-bit FNV-1a
+static uint64_t ps_store_hash(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ Create a new, empty parameter set store.
+ @return    the store
+ */
+h264_ps_store_t* h264_ps_store_new()
+{
+    h264_ps_store_t* store = (h264_ps_store_t*)calloc(1, sizeof(h264_ps_store_t));
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_init(&store->lock, NULL);
+#endif
+    return store;
+}
+
+/**
+ Free a parameter set store, and all the parameter sets in it whether or not they are still referenced.
+ The streams using the store must be freed first.
+ */
+void h264_ps_store_free(h264_ps_store_t* store)
+{
+    for (int i = 0; i < PS_STORE_BUCKETS; i++)
+    {
+        ps_store_entry_t* e = store->buckets[i];
+        while (e != NULL)
+        {
+            ps_store_entry_t* next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_destroy(&store->lock);
+#endif
+    free(store);
+}
+
+// find or add a parameter set of size bytes, and take a reference to it
+static void* ps_store_intern(h264_ps_store_t* store, int nal_unit_type, const void* ps, size_t size)
+{
+    uint64_t hash = ps_store_hash((const uint8_t*)ps, size) ^ (uint64_t)nal_unit_type;
+    ps_store_entry_t** bucket = &store->buckets[hash % PS_STORE_BUCKETS];
+    ps_store_entry_t* e;
+
+    PS_STORE_LOCK(store);
+    for (e = *bucket; e != NULL; e = e->next)
+    {
+        if (e->hash == hash && e->nal_unit_type == nal_unit_type && memcmp(e + 1, ps, size) == 0) { break; }
+    }
+    if (e != NULL)
+    {
+        e->refs++;
+    }
+    else
+    {
+        e = (ps_store_entry_t*)malloc(sizeof(ps_store_entry_t) + size);
+        e->hash = hash;
+        e->nal_unit_type = nal_unit_type;
+        e->refs = 1;
+        memcpy(e + 1, ps, size);
+        e->next = *bucket;
+        *bucket = e;
+        store->num_entries++;
+    }
+    PS_STORE_UNLOCK(store);
+
+    return e + 1;
+}
+
+/**
+ Get the copy of an SPS held by a store, adding one if the store has none with the same contents, and take
+ a reference to it.
+ @return    the copy, to be released with h264_ps_store_release
+ */
+sps_t* h264_ps_store_intern_sps(h264_ps_store_t* store, const sps_t* sps)
+{
+    return (sps_t*)ps_store_intern(store, NAL_UNIT_TYPE_SPS, sps, sizeof(sps_t));
+}
+
+/**
+ Get the copy of a PPS held by a store, as h264_ps_store_intern_sps.
+ */
+pps_t* h264_ps_store_intern_pps(h264_ps_store_t* store, const pps_t* pps)
+{
+    return (pps_t*)ps_store_intern(store, NAL_UNIT_TYPE_PPS, pps, sizeof(pps_t));
+}
+
+/**
+ Take another reference to a parameter set returned by h264_ps_store_intern_sps or h264_ps_store_intern_pps.
+ */
+void h264_ps_store_retain(h264_ps_store_t* store, const void* ps)
+{
+    ps_store_entry_t* e = (ps_store_entry_t*)ps - 1;
+    PS_STORE_LOCK(store);
+    e->refs++;
+    PS_STORE_UNLOCK(store);
+}
+
+/**
+ Drop a reference to a parameter set in a store.  It is freed when the last one is dropped.
+ */
+void h264_ps_store_release(h264_ps_store_t* store, const void* ps)
+{
+    ps_store_entry_t* e = (ps_store_entry_t*)ps - 1;
+    PS_STORE_LOCK(store);
+    if (--e->refs == 0)
+    {
+        ps_store_entry_t** p = &store->buckets[e->hash % PS_STORE_BUCKETS];
+        while (*p != e) { p = &(*p)->next; }
+        *p = e->next;
+        store->num_entries--;
+        free(e);
+    }
+    PS_STORE_UNLOCK(store);
+}
+
+/**
+ @return    the number of distinct parameter sets in a store
+ */
+int h264_ps_store_size(h264_ps_store_t* store)
+{
+    int n;
+    PS_STORE_LOCK(store);
+    n = store->num_entries;
+    PS_STORE_UNLOCK(store);
+    return n;
+}
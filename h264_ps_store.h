@@ -0,0 +1,47 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _H264_PS_STORE_H
+#define _H264_PS_STORE_H        1
+
+#include "h264_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+   A parameter set store keeps one copy of each distinct SPS and PPS, found by a hash of its contents, for any number
+   of streams.  The copies are reference counted and must not be modified.  All functions may be called from several
+   threads at once.
+   @see h264_set_ps_store
+*/
+
+h264_ps_store_t* h264_ps_store_new();
+void h264_ps_store_free(h264_ps_store_t* store);
+sps_t* h264_ps_store_intern_sps(h264_ps_store_t* store, const sps_t* sps);
+pps_t* h264_ps_store_intern_pps(h264_ps_store_t* store, const pps_t* pps);
+void h264_ps_store_retain(h264_ps_store_t* store, const void* ps);
+void h264_ps_store_release(h264_ps_store_t* store, const void* ps);
+int h264_ps_store_size(h264_ps_store_t* store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
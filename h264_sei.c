@@ -54,6 +54,19 @@ void sei_free(sei_t* s)
     free(s);
 }
 
+// zeroed memory for a payload of size bytes, reusing what was allocated for the last one read into s if it is enough
+static void* sei_payload_buf(sei_t* s, int size)
+{
+    if ( s->data == NULL || s->capacity < size )
+    {
+        free(s->data);
+        s->data = (uint8_t*)malloc(size > 0 ? size : 1);
+        s->capacity = size;
+    }
+    if ( size > 0 ) { memset(s->data, 0, size); }
+    return s->data;
+}
+
 void read_sei_end_bits(h264_stream_t* h, bs_t* b )
 {
     // if the message doesn't end at a byte border
@@ -80,51 +93,69 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
 {
     sei_scalability_info_t* sei_svc = h->sei->sei_svc;
     
-    sei_svc->temporal_id_nesting_flag = bs_read_u1(b);
-    sei_svc->priority_layer_info_present_flag = bs_read_u1(b);
-    sei_svc->priority_id_setting_flag = bs_read_u1(b);
+    {
+        uint32_t fused = bs_read_u3(b);
+        sei_svc->temporal_id_nesting_flag = fused >> 2;
+        sei_svc->priority_layer_info_present_flag = (fused >> 1) & 0x1;
+        sei_svc->priority_id_setting_flag = fused & 0x1;
+    }
     sei_svc->num_layers_minus1 = bs_read_ue(b);
     
-    for( int i = 0; i <= sei_svc->num_layers_minus1; i++ ) {
+    for( int i = 0; i <= sei_svc->num_layers_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
         sei_svc->layers[i].layer_id = bs_read_ue(b);
-        sei_svc->layers[i].priority_id = bs_read_u(b, 6);
-        sei_svc->layers[i].discardable_flag = bs_read_u1(b);
-        sei_svc->layers[i].dependency_id = bs_read_u(b, 3);
-        sei_svc->layers[i].quality_id = bs_read_u(b, 4);
-        sei_svc->layers[i].temporal_id = bs_read_u(b, 3);
-        sei_svc->layers[i].sub_pic_layer_flag = bs_read_u1(b);
-        sei_svc->layers[i].sub_region_layer_flag = bs_read_u1(b);
-        sei_svc->layers[i].iroi_division_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].profile_level_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].bitrate_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].frm_rate_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].frm_size_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].layer_dependency_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].parameter_sets_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].bitstream_restriction_info_present_flag = bs_read_u1(b);
-        sei_svc->layers[i].exact_inter_layer_pred_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_un(b, 28);
+            sei_svc->layers[i].priority_id = fused >> 22;
+            sei_svc->layers[i].discardable_flag = (fused >> 21) & 0x1;
+            sei_svc->layers[i].dependency_id = (fused >> 18) & 0x7;
+            sei_svc->layers[i].quality_id = (fused >> 14) & 0xF;
+            sei_svc->layers[i].temporal_id = (fused >> 11) & 0x7;
+            sei_svc->layers[i].sub_pic_layer_flag = (fused >> 10) & 0x1;
+            sei_svc->layers[i].sub_region_layer_flag = (fused >> 9) & 0x1;
+            sei_svc->layers[i].iroi_division_info_present_flag = (fused >> 8) & 0x1;
+            sei_svc->layers[i].profile_level_info_present_flag = (fused >> 7) & 0x1;
+            sei_svc->layers[i].bitrate_info_present_flag = (fused >> 6) & 0x1;
+            sei_svc->layers[i].frm_rate_info_present_flag = (fused >> 5) & 0x1;
+            sei_svc->layers[i].frm_size_info_present_flag = (fused >> 4) & 0x1;
+            sei_svc->layers[i].layer_dependency_info_present_flag = (fused >> 3) & 0x1;
+            sei_svc->layers[i].parameter_sets_info_present_flag = (fused >> 2) & 0x1;
+            sei_svc->layers[i].bitstream_restriction_info_present_flag = (fused >> 1) & 0x1;
+            sei_svc->layers[i].exact_inter_layer_pred_flag = fused & 0x1;
+        }
         if( sei_svc->layers[i].sub_pic_layer_flag ||
             sei_svc->layers[i].iroi_division_info_present_flag )
         {
             sei_svc->layers[i].exact_sample_value_match_flag = bs_read_u1(b);
         }
-        sei_svc->layers[i].layer_conversion_flag = bs_read_u1(b);
-        sei_svc->layers[i].layer_output_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_u2(b);
+            sei_svc->layers[i].layer_conversion_flag = fused >> 1;
+            sei_svc->layers[i].layer_output_flag = fused & 0x1;
+        }
         if( sei_svc->layers[i].profile_level_info_present_flag )
         {
-            sei_svc->layers[i].layer_profile_level_idc = bs_read_u(b, 24);
+            sei_svc->layers[i].layer_profile_level_idc = bs_read_u24(b);
         }
         if( sei_svc->layers[i].bitrate_info_present_flag )
         {
-            sei_svc->layers[i].avg_bitrate = bs_read_u(b, 16);
-            sei_svc->layers[i].max_bitrate_layer = bs_read_u(b, 16);
-            sei_svc->layers[i].max_bitrate_layer_representation = bs_read_u(b, 16);
-            sei_svc->layers[i].max_bitrate_calc_window = bs_read_u(b, 16);
+            {
+                uint32_t fused = bs_read_u32(b);
+                sei_svc->layers[i].avg_bitrate = fused >> 16;
+                sei_svc->layers[i].max_bitrate_layer = fused & 0xFFFF;
+            }
+            {
+                uint32_t fused = bs_read_u32(b);
+                sei_svc->layers[i].max_bitrate_layer_representation = fused >> 16;
+                sei_svc->layers[i].max_bitrate_calc_window = fused & 0xFFFF;
+            }
         }
         if( sei_svc->layers[i].frm_rate_info_present_flag )
         {
-            sei_svc->layers[i].constant_frm_rate_idc = bs_read_u(b, 2);
-            sei_svc->layers[i].avg_frm_rate = bs_read_u(b, 16);
+            {
+                uint32_t fused = bs_read_un(b, 18);
+                sei_svc->layers[i].constant_frm_rate_idc = fused >> 16;
+                sei_svc->layers[i].avg_frm_rate = fused & 0xFFFF;
+            }
         }
         if( sei_svc->layers[i].frm_size_info_present_flag ||
             sei_svc->layers[i].iroi_division_info_present_flag )
@@ -138,10 +169,16 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
             sei_svc->layers[i].dynamic_rect_flag = bs_read_u1(b);
             if( sei_svc->layers[i].dynamic_rect_flag )
             {
-                sei_svc->layers[i].horizontal_offset = bs_read_u(b, 16);
-                sei_svc->layers[i].vertical_offset = bs_read_u(b, 16);
-                sei_svc->layers[i].region_width = bs_read_u(b, 16);
-                sei_svc->layers[i].region_height = bs_read_u(b, 16);
+                {
+                    uint32_t fused = bs_read_u32(b);
+                    sei_svc->layers[i].horizontal_offset = fused >> 16;
+                    sei_svc->layers[i].vertical_offset = fused & 0xFFFF;
+                }
+                {
+                    uint32_t fused = bs_read_u32(b);
+                    sei_svc->layers[i].region_width = fused >> 16;
+                    sei_svc->layers[i].region_height = fused & 0xFFFF;
+                }
             }
         }
         if( sei_svc->layers[i].sub_pic_layer_flag )
@@ -160,7 +197,7 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
             {
                 sei_svc->layers[i].num_rois_minus1 = bs_read_ue(b);
                 
-                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1; j++ )
+                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1 && j < MAX_J && ! bs_error(b); j++ )
                 {
                     sei_svc->layers[i].roi[j].first_mb_in_roi = bs_read_ue(b);
                     sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1 = bs_read_ue(b);
@@ -171,7 +208,7 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].layer_dependency_info_present_flag )
         {
             sei_svc->layers[i].num_directly_dependent_layers = bs_read_ue(b);
-            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers && j < MAX_J && ! bs_error(b); j++ )
             {
                 sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j] = bs_read_ue(b);
             }
@@ -183,17 +220,17 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].parameter_sets_info_present_flag )
         {
             sei_svc->layers[i].num_seq_parameter_sets = bs_read_ue(b);
-            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 sei_svc->layers[i].seq_parameter_set_id_delta[j] = bs_read_ue(b);
             }
             sei_svc->layers[i].num_subset_seq_parameter_sets = bs_read_ue(b);
-            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 sei_svc->layers[i].subset_seq_parameter_set_id_delta[j] = bs_read_ue(b);
             }
             sei_svc->layers[i].num_pic_parameter_sets_minus1 = bs_read_ue(b);
-            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 sei_svc->layers[i].pic_parameter_set_id_delta[j] = bs_read_ue(b);
             }
@@ -217,12 +254,15 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
             sei_svc->layers[i].conversion_type_idc = bs_read_ue(b);
             for( int j = 0; j < 2; j++ )
             {
-                sei_svc->layers[i].rewriting_info_flag[j] = bs_read_u(b, 1);
+                sei_svc->layers[i].rewriting_info_flag[j] = bs_read_u1(b);
                 if( sei_svc->layers[i].rewriting_info_flag[j] )
                 {
-                    sei_svc->layers[i].rewriting_profile_level_idc[j] = bs_read_u(b, 24);
-                    sei_svc->layers[i].rewriting_avg_bitrate[j] = bs_read_u(b, 16);
-                    sei_svc->layers[i].rewriting_max_bitrate[j] = bs_read_u(b, 16);
+                    sei_svc->layers[i].rewriting_profile_level_idc[j] = bs_read_u24(b);
+                    {
+                        uint32_t fused = bs_read_u32(b);
+                        sei_svc->layers[i].rewriting_avg_bitrate[j] = fused >> 16;
+                        sei_svc->layers[i].rewriting_max_bitrate[j] = fused & 0xFFFF;
+                    }
                 }
             }
         }
@@ -232,15 +272,18 @@ void read_sei_scalability_info( h264_stream_t* h, bs_t* b )
     {
         sei_svc->pr_num_dIds_minus1 = bs_read_ue(b);
         
-        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1; i++ ) {
-            sei_svc->pr[i].pr_dependency_id = bs_read_u(b, 3);
+        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
+            sei_svc->pr[i].pr_dependency_id = bs_read_u3(b);
             sei_svc->pr[i].pr_num_minus1 = bs_read_ue(b);
-            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1; j++ )
+            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 sei_svc->pr[i].pr_info[j].pr_id = bs_read_ue(b);
-                sei_svc->pr[i].pr_info[j].pr_profile_level_idc = bs_read_u(b, 24);
-                sei_svc->pr[i].pr_info[j].pr_avg_bitrate = bs_read_u(b, 16);
-                sei_svc->pr[i].pr_info[j].pr_max_bitrate = bs_read_u(b, 16);
+                sei_svc->pr[i].pr_info[j].pr_profile_level_idc = bs_read_u24(b);
+                {
+                    uint32_t fused = bs_read_u32(b);
+                    sei_svc->pr[i].pr_info[j].pr_avg_bitrate = fused >> 16;
+                    sei_svc->pr[i].pr_info[j].pr_max_bitrate = fused & 0xFFFF;
+                }
             }
         }
         
@@ -259,18 +302,25 @@ void read_sei_payload( h264_stream_t* h, bs_t* b )
         case SEI_TYPE_SCALABILITY_INFO:
             if( 1 )
             {
-                s->sei_svc = (sei_scalability_info_t*)calloc( 1, sizeof(sei_scalability_info_t) );
+                s->sei_svc = (sei_scalability_info_t*)sei_payload_buf( s, sizeof(sei_scalability_info_t) );
             }
             read_sei_scalability_info( h, b );
             break;
         default:
             if( 1 )
             {
-                s->data = (uint8_t*)calloc(1, s->payloadSize);
+                s->data = (uint8_t*)sei_payload_buf( s, s->payloadSize );
             }
-            
-            for ( i = 0; i < s->payloadSize; i++ )
+
+            if( 1 && !0 && bs_byte_aligned(b) )
+            {
+                bs_read_bytes(b, s->data, s->payloadSize);
+                break;
+            }
+            for ( i = 0; i < s->payloadSize && ! bs_error(b); i++ )
+            {
                 s->data[i] = bs_read_u8(b);
+            }
     }
     
     //if( 1 )
@@ -292,7 +342,7 @@ void write_sei_scalability_info( h264_stream_t* h, bs_t* b )
     bs_write_u1(b, sei_svc->priority_id_setting_flag);
     bs_write_ue(b, sei_svc->num_layers_minus1);
     
-    for( int i = 0; i <= sei_svc->num_layers_minus1; i++ ) {
+    for( int i = 0; i <= sei_svc->num_layers_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
         bs_write_ue(b, sei_svc->layers[i].layer_id);
         bs_write_u(b, 6, sei_svc->layers[i].priority_id);
         bs_write_u1(b, sei_svc->layers[i].discardable_flag);
@@ -367,7 +417,7 @@ void write_sei_scalability_info( h264_stream_t* h, bs_t* b )
             {
                 bs_write_ue(b, sei_svc->layers[i].num_rois_minus1);
                 
-                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1; j++ )
+                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1 && j < MAX_J && ! bs_error(b); j++ )
                 {
                     bs_write_ue(b, sei_svc->layers[i].roi[j].first_mb_in_roi);
                     bs_write_ue(b, sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1);
@@ -378,7 +428,7 @@ void write_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].layer_dependency_info_present_flag )
         {
             bs_write_ue(b, sei_svc->layers[i].num_directly_dependent_layers);
-            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers && j < MAX_J && ! bs_error(b); j++ )
             {
                 bs_write_ue(b, sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j]);
             }
@@ -390,17 +440,17 @@ void write_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].parameter_sets_info_present_flag )
         {
             bs_write_ue(b, sei_svc->layers[i].num_seq_parameter_sets);
-            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 bs_write_ue(b, sei_svc->layers[i].seq_parameter_set_id_delta[j]);
             }
             bs_write_ue(b, sei_svc->layers[i].num_subset_seq_parameter_sets);
-            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 bs_write_ue(b, sei_svc->layers[i].subset_seq_parameter_set_id_delta[j]);
             }
             bs_write_ue(b, sei_svc->layers[i].num_pic_parameter_sets_minus1);
-            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 bs_write_ue(b, sei_svc->layers[i].pic_parameter_set_id_delta[j]);
             }
@@ -439,10 +489,10 @@ void write_sei_scalability_info( h264_stream_t* h, bs_t* b )
     {
         bs_write_ue(b, sei_svc->pr_num_dIds_minus1);
         
-        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1; i++ ) {
+        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
             bs_write_u(b, 3, sei_svc->pr[i].pr_dependency_id);
             bs_write_ue(b, sei_svc->pr[i].pr_num_minus1);
-            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1; j++ )
+            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 bs_write_ue(b, sei_svc->pr[i].pr_info[j].pr_id);
                 bs_write_u(b, 24, sei_svc->pr[i].pr_info[j].pr_profile_level_idc);
@@ -466,18 +516,25 @@ void write_sei_payload( h264_stream_t* h, bs_t* b )
         case SEI_TYPE_SCALABILITY_INFO:
             if( 0 )
             {
-                s->sei_svc = (sei_scalability_info_t*)calloc( 1, sizeof(sei_scalability_info_t) );
+                s->sei_svc = (sei_scalability_info_t*)sei_payload_buf( s, sizeof(sei_scalability_info_t) );
             }
             write_sei_scalability_info( h, b );
             break;
         default:
             if( 0 )
             {
-                s->data = (uint8_t*)calloc(1, s->payloadSize);
+                s->data = (uint8_t*)sei_payload_buf( s, s->payloadSize );
             }
-            
-            for ( i = 0; i < s->payloadSize; i++ )
+
+            if( 0 && !0 && bs_byte_aligned(b) )
+            {
+                bs_read_bytes(b, s->data, s->payloadSize);
+                break;
+            }
+            for ( i = 0; i < s->payloadSize && ! bs_error(b); i++ )
+            {
                 bs_write_u8(b, s->data[i]);
+            }
     }
     
     //if( 0 )
@@ -499,7 +556,7 @@ void read_debug_sei_scalability_info( h264_stream_t* h, bs_t* b )
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->priority_id_setting_flag = bs_read_u1(b); printf("sei_svc->priority_id_setting_flag: %d \n", sei_svc->priority_id_setting_flag); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->num_layers_minus1 = bs_read_ue(b); printf("sei_svc->num_layers_minus1: %d \n", sei_svc->num_layers_minus1); 
     
-    for( int i = 0; i <= sei_svc->num_layers_minus1; i++ ) {
+    for( int i = 0; i <= sei_svc->num_layers_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].layer_id = bs_read_ue(b); printf("sei_svc->layers[i].layer_id: %d \n", sei_svc->layers[i].layer_id); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].priority_id = bs_read_u(b, 6); printf("sei_svc->layers[i].priority_id: %d \n", sei_svc->layers[i].priority_id); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].discardable_flag = bs_read_u1(b); printf("sei_svc->layers[i].discardable_flag: %d \n", sei_svc->layers[i].discardable_flag); 
@@ -574,7 +631,7 @@ void read_debug_sei_scalability_info( h264_stream_t* h, bs_t* b )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].num_rois_minus1 = bs_read_ue(b); printf("sei_svc->layers[i].num_rois_minus1: %d \n", sei_svc->layers[i].num_rois_minus1); 
                 
-                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1; j++ )
+                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1 && j < MAX_J && ! bs_error(b); j++ )
                 {
                     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].roi[j].first_mb_in_roi = bs_read_ue(b); printf("sei_svc->layers[i].roi[j].first_mb_in_roi: %d \n", sei_svc->layers[i].roi[j].first_mb_in_roi); 
                     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1 = bs_read_ue(b); printf("sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1: %d \n", sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1); 
@@ -585,7 +642,7 @@ void read_debug_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].layer_dependency_info_present_flag )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].num_directly_dependent_layers = bs_read_ue(b); printf("sei_svc->layers[i].num_directly_dependent_layers: %d \n", sei_svc->layers[i].num_directly_dependent_layers); 
-            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers && j < MAX_J && ! bs_error(b); j++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j] = bs_read_ue(b); printf("sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j]: %d \n", sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j]); 
             }
@@ -597,17 +654,17 @@ void read_debug_sei_scalability_info( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].parameter_sets_info_present_flag )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].num_seq_parameter_sets = bs_read_ue(b); printf("sei_svc->layers[i].num_seq_parameter_sets: %d \n", sei_svc->layers[i].num_seq_parameter_sets); 
-            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].seq_parameter_set_id_delta[j] = bs_read_ue(b); printf("sei_svc->layers[i].seq_parameter_set_id_delta[j]: %d \n", sei_svc->layers[i].seq_parameter_set_id_delta[j]); 
             }
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].num_subset_seq_parameter_sets = bs_read_ue(b); printf("sei_svc->layers[i].num_subset_seq_parameter_sets: %d \n", sei_svc->layers[i].num_subset_seq_parameter_sets); 
-            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].subset_seq_parameter_set_id_delta[j] = bs_read_ue(b); printf("sei_svc->layers[i].subset_seq_parameter_set_id_delta[j]: %d \n", sei_svc->layers[i].subset_seq_parameter_set_id_delta[j]); 
             }
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].num_pic_parameter_sets_minus1 = bs_read_ue(b); printf("sei_svc->layers[i].num_pic_parameter_sets_minus1: %d \n", sei_svc->layers[i].num_pic_parameter_sets_minus1); 
-            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->layers[i].pic_parameter_set_id_delta[j] = bs_read_ue(b); printf("sei_svc->layers[i].pic_parameter_set_id_delta[j]: %d \n", sei_svc->layers[i].pic_parameter_set_id_delta[j]); 
             }
@@ -646,10 +703,10 @@ void read_debug_sei_scalability_info( h264_stream_t* h, bs_t* b )
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->pr_num_dIds_minus1 = bs_read_ue(b); printf("sei_svc->pr_num_dIds_minus1: %d \n", sei_svc->pr_num_dIds_minus1); 
         
-        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1; i++ ) {
+        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->pr[i].pr_dependency_id = bs_read_u(b, 3); printf("sei_svc->pr[i].pr_dependency_id: %d \n", sei_svc->pr[i].pr_dependency_id); 
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->pr[i].pr_num_minus1 = bs_read_ue(b); printf("sei_svc->pr[i].pr_num_minus1: %d \n", sei_svc->pr[i].pr_num_minus1); 
-            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1; j++ )
+            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->pr[i].pr_info[j].pr_id = bs_read_ue(b); printf("sei_svc->pr[i].pr_info[j].pr_id: %d \n", sei_svc->pr[i].pr_info[j].pr_id); 
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sei_svc->pr[i].pr_info[j].pr_profile_level_idc = bs_read_u(b, 24); printf("sei_svc->pr[i].pr_info[j].pr_profile_level_idc: %d \n", sei_svc->pr[i].pr_info[j].pr_profile_level_idc); 
@@ -673,21 +730,24 @@ void read_debug_sei_payload( h264_stream_t* h, bs_t* b )
         case SEI_TYPE_SCALABILITY_INFO:
             if( 1 )
             {
-                s->sei_svc = (sei_scalability_info_t*)calloc( 1, sizeof(sei_scalability_info_t) );
+                s->sei_svc = (sei_scalability_info_t*)sei_payload_buf( s, sizeof(sei_scalability_info_t) );
             }
             read_debug_sei_scalability_info( h, b );
             break;
         default:
             if( 1 )
             {
-                s->data = (uint8_t*)calloc(1, s->payloadSize);
+                s->data = (uint8_t*)sei_payload_buf( s, s->payloadSize );
             }
-            
-            for ( i = 0; i < s->payloadSize; i++ )
+
+            if( 1 && !1 && bs_byte_aligned(b) )
             {
-                printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left);
-                s->data[i] = bs_read_u8(b);
-                printf("s->data[i]: %d \n", s->data[i]); 
+                bs_read_bytes(b, s->data, s->payloadSize);
+                break;
+            }
+            for ( i = 0; i < s->payloadSize && ! bs_error(b); i++ )
+            {
+                printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); s->data[i] = bs_read_u8(b); printf("s->data[i]: %d \n", s->data[i]); 
             }
     }
     
@@ -143,6 +143,7 @@ typedef struct
         sei_scalability_info_t* sei_svc;
         uint8_t* data;
     };
+    int capacity;   // bytes allocated for the payload, which are reused when another message is read into this one
 } sei_t;
 
 sei_t* sei_new();
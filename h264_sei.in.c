@@ -54,6 +54,19 @@ void sei_free(sei_t* s)
     free(s);
 }
 
+// zeroed memory for a payload of size bytes, reusing what was allocated for the last one read into s if it is enough
+static void* sei_payload_buf(sei_t* s, int size)
+{
+    if ( s->data == NULL || s->capacity < size )
+    {
+        free(s->data);
+        s->data = (uint8_t*)malloc(size > 0 ? size : 1);
+        s->capacity = size;
+    }
+    if ( size > 0 ) { memset(s->data, 0, size); }
+    return s->data;
+}
+
 void read_sei_end_bits(h264_stream_t* h, bs_t* b )
 {
     // if the message doesn't end at a byte border
@@ -83,7 +96,7 @@ void structure(sei_scalability_info)( h264_stream_t* h, bs_t* b )
     value( sei_svc->priority_id_setting_flag, u1 );
     value( sei_svc->num_layers_minus1, ue );
     
-    for( int i = 0; i <= sei_svc->num_layers_minus1; i++ ) {
+    for( int i = 0; i <= sei_svc->num_layers_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
         value( sei_svc->layers[i].layer_id, ue );
         value( sei_svc->layers[i].priority_id, u(6) );
         value( sei_svc->layers[i].discardable_flag, u1 );
@@ -158,7 +171,7 @@ void structure(sei_scalability_info)( h264_stream_t* h, bs_t* b )
             {
                 value( sei_svc->layers[i].num_rois_minus1, ue );
                 
-                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1; j++ )
+                for( int j = 0; j <= sei_svc->layers[i].num_rois_minus1 && j < MAX_J && ! bs_error(b); j++ )
                 {
                     value( sei_svc->layers[i].roi[j].first_mb_in_roi, ue );
                     value( sei_svc->layers[i].roi[j].roi_width_in_mbs_minus1, ue );
@@ -169,7 +182,7 @@ void structure(sei_scalability_info)( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].layer_dependency_info_present_flag )
         {
             value( sei_svc->layers[i].num_directly_dependent_layers, ue );
-            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_directly_dependent_layers && j < MAX_J && ! bs_error(b); j++ )
             {
                 value( sei_svc->layers[i].directly_dependent_layer_id_delta_minus1[j], ue );
             }
@@ -181,17 +194,17 @@ void structure(sei_scalability_info)( h264_stream_t* h, bs_t* b )
         if( sei_svc->layers[i].parameter_sets_info_present_flag )
         {
             value( sei_svc->layers[i].num_seq_parameter_sets, ue );
-            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 value( sei_svc->layers[i].seq_parameter_set_id_delta[j], ue );
             }
             value( sei_svc->layers[i].num_subset_seq_parameter_sets, ue );
-            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_subset_seq_parameter_sets && j < MAX_J && ! bs_error(b); j++ )
             {
                 value( sei_svc->layers[i].subset_seq_parameter_set_id_delta[j], ue );
             }
             value( sei_svc->layers[i].num_pic_parameter_sets_minus1, ue );
-            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1; j++ )
+            for( int j = 0; j < sei_svc->layers[i].num_pic_parameter_sets_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 value( sei_svc->layers[i].pic_parameter_set_id_delta[j], ue );
             }
@@ -230,10 +243,10 @@ void structure(sei_scalability_info)( h264_stream_t* h, bs_t* b )
     {
         value( sei_svc->pr_num_dIds_minus1, ue );
         
-        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1; i++ ) {
+        for( int i = 0; i <= sei_svc->pr_num_dIds_minus1 && i < MAX_J && ! bs_error(b); i++ ) {
             value( sei_svc->pr[i].pr_dependency_id, u(3) );
             value( sei_svc->pr[i].pr_num_minus1, ue );
-            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1; j++ )
+            for( int j = 0; j <= sei_svc->pr[i].pr_num_minus1 && j < MAX_J && ! bs_error(b); j++ )
             {
                 value( sei_svc->pr[i].pr_info[j].pr_id, ue );
                 value( sei_svc->pr[i].pr_info[j].pr_profile_level_idc, u(24) );
@@ -257,18 +270,25 @@ void structure(sei_payload)( h264_stream_t* h, bs_t* b )
         case SEI_TYPE_SCALABILITY_INFO:
             if( is_reading )
             {
-                s->sei_svc = (uint8_t*)calloc( 1, sizeof(sei_scalability_info_t) );
+                s->sei_svc = (sei_scalability_info_t*)sei_payload_buf( s, sizeof(sei_scalability_info_t) );
             }
             structure(sei_scalability_info)( h, b );
             break;
         default:
             if( is_reading )
             {
-                s->data = (uint8_t*)calloc(1, s->payloadSize);
+                s->data = (uint8_t*)sei_payload_buf( s, s->payloadSize );
             }
-            
-            for ( i = 0; i < s->payloadSize; i++ )
+
+            if( is_reading && !is_debug && bs_byte_aligned(b) )
+            {
+                bs_read_bytes(b, s->data, s->payloadSize);
+                break;
+            }
+            for ( i = 0; i < s->payloadSize && ! bs_error(b); i++ )
+            {
                 value( s->data[i], u8 );
+            }
     }
     
     //if( is_reading )
@@ -63,24 +63,8 @@ int more_rbsp_data(bs_t* bs)
 {
     // TODO this version handles reading only. writing version?
 
-    // no more data
-    if (bs_eof(bs)) { return 0; }
-
-    // no rbsp_stop_bit yet
-    if (bs_peek_u1(bs) == 0) { return 1; }
-
-    // next bit is 1, is it the rsbp_stop_bit? only if the rest of bits are 0
-    bs_t bs_tmp;
-    bs_clone(&bs_tmp, bs);
-    bs_skip_u1(&bs_tmp);
-    while(!bs_eof(&bs_tmp))
-    {
-        // A later bit was 1, it wasn't the rsbp_stop_bit
-        if (bs_read_u1(&bs_tmp) == 1) { return 1; }
-    }
-
-    // All following bits were 0, it was the rsbp_stop_bit
-    return 0;
+    // there is more data if we have not reached the rbsp_stop_bit, which is the last 1 bit in the buffer
+    return bs_before_stop_bit(bs);
 }
 
 int more_rbsp_trailing_data(h264_stream_t* h, bs_t* b) { return !bs_eof(b); }
@@ -163,24 +147,45 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
     int nal_size = size;
     int rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    uint8_t* rbsp_buf;
+    bs_t bs;
+    bs_t* b;
+
+    // whatever was read from the last NAL is released, see h264_arena_t
+    h264_arena_reset(&h->arena);
+    h->slice_data->rbsp_buf = NULL;
+    h->slice_data->rbsp_size = 0;
 
     if( 1 )
     {
-        int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+        // the RBSP is produced as the parser reads it, so for a slice only the header is copied here
+        rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, rbsp_size + BS_PADDING);
+        b = bs_init_nal(&bs, rbsp_buf, buf, nal_size);
 
-        if (rc < 0) { free(rbsp_buf); return -1; } // handle conversion error
+        // other NALs are small, convert them whole and reject bad ones before parsing anything
+        int nal_unit_type = (size > 0) ? (buf[0] & 0x1F) : 0;
+        if( nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_AUX &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION )
+        {
+            bs_unescape_all(b);
+            if (bs_error(b)) { return -1; } // handle conversion error
+        }
     }
-
-    if( 0 )
+    else
     {
-        rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
+        // the RBSP is written straight into buf after the first byte, and escaped in place at the end
+        rbsp_size = (size > 1) ? size - 1 : 0;
+        b = bs_init(&bs, buf + 1, rbsp_size);
     }
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
-    /* forbidden_zero_bit */ bs_skip_u(b, 1);
-    nal->nal_ref_idc = bs_read_u(b, 2);
-    nal->nal_unit_type = bs_read_u(b, 5);
+    {
+        uint32_t fused = bs_read_u8(b);
+        /* forbidden_zero_bit */
+        nal->nal_ref_idc = (fused >> 5) & 0x3;
+        nal->nal_unit_type = fused & 0x1F;
+    }
     
     if( nal->nal_unit_type == 14 || nal->nal_unit_type == 21 || nal->nal_unit_type == 20 )
     {
@@ -215,12 +220,14 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 #endif
 
         case NAL_UNIT_TYPE_SPS: 
+            if( 1 ) { h->sps = h->sps_buf; }
             read_seq_parameter_set_rbsp(h->sps, b);
             read_rbsp_trailing_bits(b);
             
             if( 1 )
             {
-                memcpy(h->sps_table[h->sps->seq_parameter_set_id], h->sps, sizeof(sps_t));
+                sps_t* sps_entry = h264_sps_table_put(h, h->sps);
+                if( sps_entry != NULL ) { h->sps = sps_entry; }
             }
 
             break;
@@ -247,15 +254,20 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
         //SVC support
         case NAL_UNIT_TYPE_SUBSET_SPS:
+            if( 1 ) { h->sps_subset = h->sps_subset_buf; }
             read_subset_seq_parameter_set_rbsp(h->sps_subset, b);
             read_rbsp_trailing_bits(b);
             
             if( 1 )
             {
-                memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id], h->sps_subset, sizeof(sps_subset_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps, h->sps_subset->sps, sizeof(sps_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
-                //h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                sps_subset_t* sps_subset_entry = h264_sps_subset_table_entry(h, h->sps_subset->sps->seq_parameter_set_id);
+                if( sps_subset_entry != NULL )
+                {
+                    memcpy(sps_subset_entry->sps, h->sps_subset->sps, sizeof(sps_t));
+                    memcpy(sps_subset_entry->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
+                    sps_subset_entry->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                    h->sps_subset = sps_subset_entry;
+                }
             }
 
             break;
@@ -279,24 +291,31 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
         case NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_B: 
         case NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_C:
         default:
-            bs_free(b);
-            free(rbsp_buf);
             return -1;
     }
 
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if( 1 )
+    {
+        // anything the parser did not reach is still checked for forbidden sequences
+        bs_unescape_all(b);
+        nal_size = b->src_p - buf;
+    }
+
+    if (bs_overrun(b) || bs_error(b)) { return -1; }
 
     if( 0 )
     {
         // now get the actual size used
-        rbsp_size = bs_pos(b);
+        rbsp_size = bs_write_finalize(b);
 
-        int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf, &nal_size);
-        if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
-    }
+        // make room for the emulation prevention bytes before the RBSP, rbsp_to_nal then fills it in going forward
+        int n = rbsp_to_nal_size(buf + 1, rbsp_size) - rbsp_size - 1;
+        if (rbsp_size + n + 1 > size) { return -1; }
+        if (n > 0) { memmove(buf + 1 + n, buf + 1, rbsp_size); }
 
-    bs_free(b);
-    free(rbsp_buf);
+        int rc = rbsp_to_nal(buf + 1 + n, &rbsp_size, buf, &nal_size);
+        if (rc < 0) { return -1; }
+    }
 
     return nal_size;
 }
@@ -304,16 +323,19 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 //G.7.3.1.1 NAL unit header SVC extension syntax
 void read_nal_unit_header_svc_extension(nal_svc_ext_t* nal_svc_ext, bs_t* b)
 {
-    nal_svc_ext->idr_flag = bs_read_u1(b);
-    nal_svc_ext->priority_id = bs_read_u(b, 6);
-    nal_svc_ext->no_inter_layer_pred_flag = bs_read_u1(b);
-    nal_svc_ext->dependency_id = bs_read_u(b, 3);
-    nal_svc_ext->quality_id = bs_read_u(b, 4);
-    nal_svc_ext->temporal_id = bs_read_u(b, 3);
-    nal_svc_ext->use_ref_base_pic_flag = bs_read_u1(b);
-    nal_svc_ext->discardable_flag = bs_read_u1(b);
-    nal_svc_ext->output_flag = bs_read_u1(b);
-    nal_svc_ext->reserved_three_2bits = bs_read_u(b, 2);
+    {
+        uint32_t fused = bs_read_un(b, 23);
+        nal_svc_ext->idr_flag = fused >> 22;
+        nal_svc_ext->priority_id = (fused >> 16) & 0x3F;
+        nal_svc_ext->no_inter_layer_pred_flag = (fused >> 15) & 0x1;
+        nal_svc_ext->dependency_id = (fused >> 12) & 0x7;
+        nal_svc_ext->quality_id = (fused >> 8) & 0xF;
+        nal_svc_ext->temporal_id = (fused >> 5) & 0x7;
+        nal_svc_ext->use_ref_base_pic_flag = (fused >> 4) & 0x1;
+        nal_svc_ext->discardable_flag = (fused >> 3) & 0x1;
+        nal_svc_ext->output_flag = (fused >> 2) & 0x1;
+        nal_svc_ext->reserved_three_2bits = fused & 0x3;
+    }
 }
 
 //G.7.3.2.12.1 Prefix NAL unit SVC syntax
@@ -365,15 +387,18 @@ void read_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         sps->chroma_format_idc = 1; 
     }
  
-    sps->profile_idc = bs_read_u8(b);
-    sps->constraint_set0_flag = bs_read_u1(b);
-    sps->constraint_set1_flag = bs_read_u1(b);
-    sps->constraint_set2_flag = bs_read_u1(b);
-    sps->constraint_set3_flag = bs_read_u1(b);
-    sps->constraint_set4_flag = bs_read_u1(b);
-    sps->constraint_set5_flag = bs_read_u1(b);
-    /* reserved_zero_2bits */ bs_skip_u(b, 2);
-    sps->level_idc = bs_read_u8(b);
+    {
+        uint32_t fused = bs_read_u24(b);
+        sps->profile_idc = fused >> 16;
+        sps->constraint_set0_flag = (fused >> 15) & 0x1;
+        sps->constraint_set1_flag = (fused >> 14) & 0x1;
+        sps->constraint_set2_flag = (fused >> 13) & 0x1;
+        sps->constraint_set3_flag = (fused >> 12) & 0x1;
+        sps->constraint_set4_flag = (fused >> 11) & 0x1;
+        sps->constraint_set5_flag = (fused >> 10) & 0x1;
+        /* reserved_zero_2bits */
+        sps->level_idc = fused & 0xFF;
+    }
     sps->seq_parameter_set_id = bs_read_ue(b);
 
     if( sps->profile_idc == 100 || sps->profile_idc == 110 ||
@@ -391,8 +416,11 @@ void read_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         }
         sps->bit_depth_luma_minus8 = bs_read_ue(b);
         sps->bit_depth_chroma_minus8 = bs_read_ue(b);
-        sps->qpprime_y_zero_transform_bypass_flag = bs_read_u1(b);
-        sps->seq_scaling_matrix_present_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_u2(b);
+            sps->qpprime_y_zero_transform_bypass_flag = fused >> 1;
+            sps->seq_scaling_matrix_present_flag = fused & 0x1;
+        }
         if( sps->seq_scaling_matrix_present_flag )
         {
             for( i = 0; i < ((sps->chroma_format_idc != 3) ? 8 : 12); i++ )
@@ -426,10 +454,7 @@ void read_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         sps->offset_for_non_ref_pic = bs_read_se(b);
         sps->offset_for_top_to_bottom_field = bs_read_se(b);
         sps->num_ref_frames_in_pic_order_cnt_cycle = bs_read_ue(b);
-        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; i++ )
-        {
-            sps->offset_for_ref_frame[ i ] = bs_read_se(b);
-        }
+        bs_read_se_array(b, sps->offset_for_ref_frame, (sps->num_ref_frames_in_pic_order_cnt_cycle < 256) ? sps->num_ref_frames_in_pic_order_cnt_cycle : 256);
     }
     sps->num_ref_frames = bs_read_ue(b);
     sps->gaps_in_frame_num_value_allowed_flag = bs_read_u1(b);
@@ -440,8 +465,11 @@ void read_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
     {
         sps->mb_adaptive_frame_field_flag = bs_read_u1(b);
     }
-    sps->direct_8x8_inference_flag = bs_read_u1(b);
-    sps->frame_cropping_flag = bs_read_u1(b);
+    {
+        uint32_t fused = bs_read_u2(b);
+        sps->direct_8x8_inference_flag = fused >> 1;
+        sps->frame_cropping_flag = fused & 0x1;
+    }
     if( sps->frame_cropping_flag )
     {
         sps->frame_crop_left_offset = bs_read_ue(b);
@@ -463,7 +491,7 @@ void read_scaling_list(bs_t* b, int* scalingList, int sizeOfScalingList, int* us
     int lastScale = 8;
     int nextScale = 8;
     int delta_scale;
-    for( int j = 0; j < sizeOfScalingList; j++ )
+    for( int j = 0; j < sizeOfScalingList && ! bs_error(b); j++ )
     {
         if( nextScale != 0 )
         {
@@ -527,22 +555,28 @@ void read_subset_seq_parameter_set_rbsp(sps_subset_t* sps_subset, bs_t* b)
 void read_seq_parameter_set_svc_extension(sps_subset_t* sps_subset, bs_t* b)
 {
     sps_svc_ext_t* sps_svc_ext = sps_subset->sps_svc_ext;
-    sps_svc_ext->inter_layer_deblocking_filter_control_present_flag = bs_read_u1(b);
-    sps_svc_ext->extended_spatial_scalability_idc = bs_read_u(b, 2);
+    {
+        uint32_t fused = bs_read_u3(b);
+        sps_svc_ext->inter_layer_deblocking_filter_control_present_flag = fused >> 2;
+        sps_svc_ext->extended_spatial_scalability_idc = fused & 0x3;
+    }
     if( sps_subset->sps->chroma_format_idc == 1 || sps_subset->sps->chroma_format_idc == 2 )
     {
         sps_svc_ext->chroma_phase_x_plus1_flag = bs_read_u1(b);
     }
     if( sps_subset->sps->chroma_format_idc == 1 )
     {
-        sps_svc_ext->chroma_phase_y_plus1 = bs_read_u(b, 2);
+        sps_svc_ext->chroma_phase_y_plus1 = bs_read_u2(b);
     }
     if( sps_svc_ext->extended_spatial_scalability_idc )
     {
         if( sps_subset->sps->chroma_format_idc > 0 )
         {
-            sps_svc_ext->seq_ref_layer_chroma_phase_x_plus1_flag = bs_read_u1(b);
-            sps_svc_ext->seq_ref_layer_chroma_phase_y_plus1 = bs_read_u(b, 2);
+            {
+                uint32_t fused = bs_read_u3(b);
+                sps_svc_ext->seq_ref_layer_chroma_phase_x_plus1_flag = fused >> 2;
+                sps_svc_ext->seq_ref_layer_chroma_phase_y_plus1 = fused & 0x3;
+            }
         }
         sps_svc_ext->seq_scaled_ref_layer_left_offset = bs_read_se(b);
         sps_svc_ext->seq_scaled_ref_layer_top_offset = bs_read_se(b);
@@ -561,16 +595,19 @@ void read_seq_parameter_set_svc_extension(sps_subset_t* sps_subset, bs_t* b)
 void read_svc_vui_parameters_extension(sps_svc_ext_t* sps_svc_ext, bs_t* b)
 {
     sps_svc_ext->vui.vui_ext_num_entries_minus1 = bs_read_ue(b);
-    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1; i++ )
+    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1 && i < MAX_J && ! bs_error(b); i++ )
     {
-        sps_svc_ext->vui.vui_ext_dependency_id[i] = bs_read_u(b, 3);
-        sps_svc_ext->vui.vui_ext_quality_id[i] = bs_read_u(b, 4);
-        sps_svc_ext->vui.vui_ext_temporal_id[i] = bs_read_u(b, 3);
-        sps_svc_ext->vui.vui_ext_timing_info_present_flag[i] = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_un(b, 11);
+            sps_svc_ext->vui.vui_ext_dependency_id[i] = fused >> 8;
+            sps_svc_ext->vui.vui_ext_quality_id[i] = (fused >> 4) & 0xF;
+            sps_svc_ext->vui.vui_ext_temporal_id[i] = (fused >> 1) & 0x7;
+            sps_svc_ext->vui.vui_ext_timing_info_present_flag[i] = fused & 0x1;
+        }
         if( sps_svc_ext->vui.vui_ext_timing_info_present_flag[i] )
         {
-            sps_svc_ext->vui.vui_ext_num_units_in_tick[i] = bs_read_u(b, 32);
-            sps_svc_ext->vui.vui_ext_time_scale[i] = bs_read_u(b, 32);
+            sps_svc_ext->vui.vui_ext_num_units_in_tick[i] = bs_read_u32(b);
+            sps_svc_ext->vui.vui_ext_time_scale[i] = bs_read_u32(b);
             sps_svc_ext->vui.vui_ext_fixed_frame_rate_flag[i] = bs_read_u1(b);
         }
 
@@ -603,8 +640,11 @@ void read_vui_parameters(sps_t* sps, bs_t* b)
         sps->vui.aspect_ratio_idc = bs_read_u8(b);
         if( sps->vui.aspect_ratio_idc == SAR_Extended )
         {
-            sps->vui.sar_width = bs_read_u(b, 16);
-            sps->vui.sar_height = bs_read_u(b, 16);
+            {
+                uint32_t fused = bs_read_u32(b);
+                sps->vui.sar_width = fused >> 16;
+                sps->vui.sar_height = fused & 0xFFFF;
+            }
         }
     }
     sps->vui.overscan_info_present_flag = bs_read_u1(b);
@@ -615,14 +655,20 @@ void read_vui_parameters(sps_t* sps, bs_t* b)
     sps->vui.video_signal_type_present_flag = bs_read_u1(b);
     if( sps->vui.video_signal_type_present_flag )
     {
-        sps->vui.video_format = bs_read_u(b, 3);
-        sps->vui.video_full_range_flag = bs_read_u1(b);
-        sps->vui.colour_description_present_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_u5(b);
+            sps->vui.video_format = fused >> 2;
+            sps->vui.video_full_range_flag = (fused >> 1) & 0x1;
+            sps->vui.colour_description_present_flag = fused & 0x1;
+        }
         if( sps->vui.colour_description_present_flag )
         {
-            sps->vui.colour_primaries = bs_read_u8(b);
-            sps->vui.transfer_characteristics = bs_read_u8(b);
-            sps->vui.matrix_coefficients = bs_read_u8(b);
+            {
+                uint32_t fused = bs_read_u24(b);
+                sps->vui.colour_primaries = fused >> 16;
+                sps->vui.transfer_characteristics = (fused >> 8) & 0xFF;
+                sps->vui.matrix_coefficients = fused & 0xFF;
+            }
         }
     }
     sps->vui.chroma_loc_info_present_flag = bs_read_u1(b);
@@ -634,8 +680,8 @@ void read_vui_parameters(sps_t* sps, bs_t* b)
     sps->vui.timing_info_present_flag = bs_read_u1(b);
     if( sps->vui.timing_info_present_flag )
     {
-        sps->vui.num_units_in_tick = bs_read_u(b, 32);
-        sps->vui.time_scale = bs_read_u(b, 32);
+        sps->vui.num_units_in_tick = bs_read_u32(b);
+        sps->vui.time_scale = bs_read_u32(b);
         sps->vui.fixed_frame_rate_flag = bs_read_u1(b);
     }
     sps->vui.nal_hrd_parameters_present_flag = bs_read_u1(b);
@@ -652,8 +698,11 @@ void read_vui_parameters(sps_t* sps, bs_t* b)
     {
         sps->vui.low_delay_hrd_flag = bs_read_u1(b);
     }
-    sps->vui.pic_struct_present_flag = bs_read_u1(b);
-    sps->vui.bitstream_restriction_flag = bs_read_u1(b);
+    {
+        uint32_t fused = bs_read_u2(b);
+        sps->vui.pic_struct_present_flag = fused >> 1;
+        sps->vui.bitstream_restriction_flag = fused & 0x1;
+    }
     if( sps->vui.bitstream_restriction_flag )
     {
         sps->vui.motion_vectors_over_pic_boundaries_flag = bs_read_u1(b);
@@ -671,18 +720,24 @@ void read_vui_parameters(sps_t* sps, bs_t* b)
 void read_hrd_parameters(hrd_t* hrd, bs_t* b)
 {
     hrd->cpb_cnt_minus1 = bs_read_ue(b);
-    hrd->bit_rate_scale = bs_read_u(b, 4);
-    hrd->cpb_size_scale = bs_read_u(b, 4);
-    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1; SchedSelIdx++ )
+    {
+        uint32_t fused = bs_read_u8(b);
+        hrd->bit_rate_scale = fused >> 4;
+        hrd->cpb_size_scale = fused & 0xF;
+    }
+    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1 && SchedSelIdx < 32 && ! bs_error(b); SchedSelIdx++ )
     {
         hrd->bit_rate_value_minus1[ SchedSelIdx ] = bs_read_ue(b);
         hrd->cpb_size_value_minus1[ SchedSelIdx ] = bs_read_ue(b);
         hrd->cbr_flag[ SchedSelIdx ] = bs_read_u1(b);
     }
-    hrd->initial_cpb_removal_delay_length_minus1 = bs_read_u(b, 5);
-    hrd->cpb_removal_delay_length_minus1 = bs_read_u(b, 5);
-    hrd->dpb_output_delay_length_minus1 = bs_read_u(b, 5);
-    hrd->time_offset_length = bs_read_u(b, 5);
+    {
+        uint32_t fused = bs_read_un(b, 20);
+        hrd->initial_cpb_removal_delay_length_minus1 = fused >> 15;
+        hrd->cpb_removal_delay_length_minus1 = (fused >> 10) & 0x1F;
+        hrd->dpb_output_delay_length_minus1 = (fused >> 5) & 0x1F;
+        hrd->time_offset_length = fused & 0x1F;
+    }
 }
 
 
@@ -706,16 +761,20 @@ int read_seq_parameter_set_extension_rbsp(bs_t* b, sps_ext_t* sps_ext) {
 //7.3.2.2 Picture parameter set RBSP syntax
 void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 {
-    pps_t* pps = h->pps;
     if( 1 )
     {
-        memset(pps, 0, sizeof(pps_t));
+        h->pps = h->pps_buf;
+        memset(h->pps, 0, sizeof(pps_t));
     }
+    pps_t* pps = h->pps;
 
     pps->pic_parameter_set_id = bs_read_ue(b);
     pps->seq_parameter_set_id = bs_read_ue(b);
-    pps->entropy_coding_mode_flag = bs_read_u1(b);
-    pps->pic_order_present_flag = bs_read_u1(b);
+    {
+        uint32_t fused = bs_read_u2(b);
+        pps->entropy_coding_mode_flag = fused >> 1;
+        pps->pic_order_present_flag = fused & 0x1;
+    }
     pps->num_slice_groups_minus1 = bs_read_ue(b);
 
     if( pps->num_slice_groups_minus1 > 0 )
@@ -723,14 +782,11 @@ void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         pps->slice_group_map_type = bs_read_ue(b);
         if( pps->slice_group_map_type == 0 )
         {
-            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1; i_group++ )
-            {
-                pps->run_length_minus1[ i_group ] = bs_read_ue(b);
-            }
+            bs_read_ue_array(b, pps->run_length_minus1, (pps->num_slice_groups_minus1 + 1 < 8) ? pps->num_slice_groups_minus1 + 1 : 8);
         }
         else if( pps->slice_group_map_type == 2 )
         {
-            for( int i_group = 0; i_group < pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group < pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 pps->top_left[ i_group ] = bs_read_ue(b);
                 pps->bottom_right[ i_group ] = bs_read_ue(b);
@@ -746,7 +802,7 @@ void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         else if( pps->slice_group_map_type == 6 )
         {
             pps->pic_size_in_map_units_minus1 = bs_read_ue(b);
-            for( int i = 0; i <= pps->pic_size_in_map_units_minus1; i++ )
+            for( int i = 0; i <= pps->pic_size_in_map_units_minus1 && i < 256 && ! bs_error(b); i++ )
             {
                 int v = intlog2( pps->num_slice_groups_minus1 + 1 );
                 pps->slice_group_id[ i ] = bs_read_u(b, v);
@@ -755,14 +811,20 @@ void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
     }
     pps->num_ref_idx_l0_active_minus1 = bs_read_ue(b);
     pps->num_ref_idx_l1_active_minus1 = bs_read_ue(b);
-    pps->weighted_pred_flag = bs_read_u1(b);
-    pps->weighted_bipred_idc = bs_read_u(b, 2);
+    {
+        uint32_t fused = bs_read_u3(b);
+        pps->weighted_pred_flag = fused >> 2;
+        pps->weighted_bipred_idc = fused & 0x3;
+    }
     pps->pic_init_qp_minus26 = bs_read_se(b);
     pps->pic_init_qs_minus26 = bs_read_se(b);
     pps->chroma_qp_index_offset = bs_read_se(b);
-    pps->deblocking_filter_control_present_flag = bs_read_u1(b);
-    pps->constrained_intra_pred_flag = bs_read_u1(b);
-    pps->redundant_pic_cnt_present_flag = bs_read_u1(b);
+    {
+        uint32_t fused = bs_read_u3(b);
+        pps->deblocking_filter_control_present_flag = fused >> 2;
+        pps->constrained_intra_pred_flag = (fused >> 1) & 0x1;
+        pps->redundant_pic_cnt_present_flag = fused & 0x1;
+    }
 
     int have_more_data = 0;
     if( 1 ) { have_more_data = more_rbsp_data(b); }
@@ -773,11 +835,14 @@ void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 
     if( have_more_data )
     {
-        pps->transform_8x8_mode_flag = bs_read_u1(b);
-        pps->pic_scaling_matrix_present_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_u2(b);
+            pps->transform_8x8_mode_flag = fused >> 1;
+            pps->pic_scaling_matrix_present_flag = fused & 0x1;
+        }
         if( pps->pic_scaling_matrix_present_flag )
         {
-            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag; i++ )
+            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag && ! bs_error(b); i++ )
             {
                 pps->pic_scaling_list_present_flag[ i ] = bs_read_u1(b);
                 if( pps->pic_scaling_list_present_flag[ i ] )
@@ -800,7 +865,8 @@ void read_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 
     if( 1 )
     {
-        memcpy(h->pps_table[pps->pic_parameter_set_id], h->pps, sizeof(pps_t));
+        pps_t* pps_entry = h264_pps_table_put(h, h->pps);
+        if( pps_entry != NULL ) { h->pps = pps_entry; }
     }
 }
 
@@ -810,19 +876,22 @@ void read_sei_rbsp(h264_stream_t* h, bs_t* b)
 {
     if( 1 )
     {
-        for( int i = 0; i < h->num_seis; i++ )
-        {
-            sei_free(h->seis[i]);
-        }
-    
+        // the messages of the last SEI, and those past them, are read into again; seis set up for writing are taken over
+        if( h->seis_capacity < h->num_seis ) { h->seis_capacity = h->num_seis; }
+
         h->num_seis = 0;
         do {
-            h->num_seis++;
-            h->seis = (sei_t**)realloc(h->seis, h->num_seis * sizeof(sei_t*));
-            h->seis[h->num_seis - 1] = sei_new();
-            h->sei = h->seis[h->num_seis - 1];
+            if( h->num_seis == h->seis_capacity )
+            {
+                int capacity = ( h->seis_capacity > 0 ) ? 2 * h->seis_capacity : 4;
+                h->seis = (sei_t**)realloc(h->seis, capacity * sizeof(sei_t*));
+                memset(h->seis + h->seis_capacity, 0, ( capacity - h->seis_capacity ) * sizeof(sei_t*));
+                h->seis_capacity = capacity;
+            }
+            if( h->seis[h->num_seis] == NULL ) { h->seis[h->num_seis] = sei_new(); }
+            h->sei = h->seis[h->num_seis++];
             read_sei_message(h, b);
-        } while( more_rbsp_data(b) );
+        } while( more_rbsp_data(b) && ! bs_error(b) );
     }
 
     if( 0 )
@@ -856,7 +925,7 @@ void read_sei_message(h264_stream_t* h, bs_t* b)
 //7.3.2.4 Access unit delimiter RBSP syntax
 void read_access_unit_delimiter_rbsp(h264_stream_t* h, bs_t* b)
 {
-    h->aud->primary_pic_type = bs_read_u(b, 3);
+    h->aud->primary_pic_type = bs_read_u3(b);
 }
 
 //7.3.2.5 End of sequence RBSP syntax
@@ -872,6 +941,7 @@ void read_end_of_stream_rbsp(h264_stream_t* h, bs_t* b)
 //7.3.2.7 Filler data RBSP syntax
 void read_filler_data_rbsp(h264_stream_t* h, bs_t* b)
 {
+    if( 1 && !0 ) { bs_skip_run(b, 0xFF); }
     while( bs_next_bits(b, 8) == 0xFF )
     {
         /* ff_byte */ bs_skip_u(b, 8);
@@ -890,14 +960,38 @@ void read_slice_layer_rbsp(h264_stream_t* h,  bs_t* b)
 
     if ( slice_data != NULL )
     {
-        if ( slice_data->rbsp_buf != NULL ) free( slice_data->rbsp_buf ); 
         uint8_t *sptr = b->p + (!!b->bits_left); // CABAC-specific: skip alignment bits, if there are any
+        int nal_left = 0;
+
+        if( 1 )
+        {
+            // the rest of the NAL is converted straight into slice_data->rbsp_buf, see bs_init_nal
+            bs_need(b, sptr - b->p);
+            nal_left = b->src_end - b->src_p;
+        }
+
         slice_data->rbsp_size = b->end - sptr;
-        
-        slice_data->rbsp_buf = (uint8_t*)malloc(slice_data->rbsp_size);
-        memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
-        // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
-        return;
+
+        if ( slice_data->rbsp_size > 0 || nal_left > 0 )
+        {
+            slice_data->rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, slice_data->rbsp_size + nal_left);
+            memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
+            if ( nal_left > 0 )
+            {
+                int rbsp_left = nal_left;
+                if ( nal_to_rbsp(b->src_p, &nal_left, slice_data->rbsp_buf + slice_data->rbsp_size, &rbsp_left) < 0 ) { b->error = 1; rbsp_left = 0; }
+                slice_data->rbsp_size += rbsp_left;
+                b->src_p += nal_left;
+                b->src_end = b->src_p;
+            }
+            // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
+            return;
+        }
+        else
+        {
+            slice_data->rbsp_buf = NULL;
+            slice_data->rbsp_size = 0;
+        }
     }
 
     // FIXME should read or skip data
@@ -940,6 +1034,7 @@ void read_rbsp_slice_trailing_bits(h264_stream_t* h, bs_t* b)
     read_rbsp_trailing_bits(b);
     if( h->pps->entropy_coding_mode_flag )
     {
+        if( 1 && !0 ) { bs_skip_run(b, 0x00); }
         while( more_rbsp_trailing_data(h, b) )
         {
             /* cabac_zero_word */ bs_skip_u(b, 16);
@@ -956,6 +1051,11 @@ void read_rbsp_trailing_bits(bs_t* b)
     {
         /* rbsp_alignment_zero_bit */ bs_skip_u(b, 1);
     }
+
+    if( 0 )
+    {
+        bs_write_flush(b);
+    }
 }
 
 //7.3.3 Slice header syntax
@@ -964,7 +1064,7 @@ void read_slice_header(h264_stream_t* h, bs_t* b)
     slice_header_t* sh = h->sh;
     if( 1 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
     }
 
     nal_t* nal = h->nal;
@@ -973,15 +1073,15 @@ void read_slice_header(h264_stream_t* h, bs_t* b)
     sh->slice_type = bs_read_ue(b);
     sh->pic_parameter_set_id = bs_read_ue(b);
 
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_t* sps = h->sps;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(h->sps, h->sps_table[pps->seq_parameter_set_id], sizeof(sps_t));
 
     if (sps->residual_colour_transform_flag)
     {
-        sh->colour_plane_id = bs_read_u(b, 2);
+        sh->colour_plane_id = bs_read_u2(b);
     }
     
     sh->frame_num = bs_read_u(b, sps->log2_max_frame_num_minus4 + 4 ); // was u(v)
@@ -1098,7 +1198,7 @@ void read_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     sh->rplr.reorder_l0.long_term_pic_num[ n ] = bs_read_ue(b);
                 }
-            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
@@ -1120,7 +1220,7 @@ void read_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     sh->rplr.reorder_l1.long_term_pic_num[ n ] = bs_read_ue(b);
                 }
-            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -1134,12 +1234,17 @@ void read_pred_weight_table(h264_stream_t* h, bs_t* b)
 
     int i, j;
 
+    if( 1 )
+    {
+        sh->pwt_read = 1;
+    }
+
     sh->pwt.luma_log2_weight_denom = bs_read_ue(b);
-    if( sps->chroma_format_idc != 0 )
+    if( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
     {
         sh->pwt.chroma_log2_weight_denom = bs_read_ue(b);
     }
-    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1; i++ )
+    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1 && i < 64 && ! bs_error(b); i++ )
     {
         sh->pwt.luma_weight_l0_flag[i] = bs_read_u1(b);
         if( sh->pwt.luma_weight_l0_flag[i] )
@@ -1147,7 +1252,7 @@ void read_pred_weight_table(h264_stream_t* h, bs_t* b)
             sh->pwt.luma_weight_l0[ i ] = bs_read_se(b);
             sh->pwt.luma_offset_l0[ i ] = bs_read_se(b);
         }
-        if ( sps->chroma_format_idc != 0 )
+        if ( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
         {
             sh->pwt.chroma_weight_l0_flag[i] = bs_read_u1(b);
             if( sh->pwt.chroma_weight_l0_flag[i] )
@@ -1162,7 +1267,7 @@ void read_pred_weight_table(h264_stream_t* h, bs_t* b)
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
     {
-        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1; i++ )
+        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1 && i < 64 && ! bs_error(b); i++ )
         {
             sh->pwt.luma_weight_l1_flag[i] = bs_read_u1(b);
             if( sh->pwt.luma_weight_l1_flag[i] )
@@ -1194,8 +1299,11 @@ void read_dec_ref_pic_marking(h264_stream_t* h, bs_t* b)
 
     if( h->nal->nal_unit_type == 5 )
     {
-        sh->drpm.no_output_of_prior_pics_flag = bs_read_u1(b);
-        sh->drpm.long_term_reference_flag = bs_read_u1(b);
+        {
+            uint32_t fused = bs_read_u2(b);
+            sh->drpm.no_output_of_prior_pics_flag = fused >> 1;
+            sh->drpm.long_term_reference_flag = fused & 0x1;
+        }
     }
     else
     {
@@ -1225,7 +1333,7 @@ void read_dec_ref_pic_marking(h264_stream_t* h, bs_t* b)
                 {
                     sh->drpm.max_long_term_frame_idx_plus1[ n ] = bs_read_ue(b);
                 }
-            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && ! bs_eof(b) );
+            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -1237,7 +1345,7 @@ void read_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     slice_header_svc_ext_t* sh_svc_ext = h->sh_svc_ext;
     if( 1 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
         memset(sh_svc_ext, 0, sizeof(slice_header_svc_ext_t));
     }
     
@@ -1247,17 +1355,15 @@ void read_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     sh->slice_type = bs_read_ue(b);
     sh->pic_parameter_set_id = bs_read_ue(b);
     
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps_subset(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_subset_t* sps_subset = h->sps_subset;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(sps_subset, h->sps_subset_table[pps->seq_parameter_set_id], sizeof(sps_subset_t));
-    //memcpy(h->sps_subset->sps, h->sps_subset_table[pps->seq_parameter_set_id]->sps, sizeof(sps_t));
-    //memcpy(h->sps_subset->sps_svc_ext, h->sps_subset_table[pps->seq_parameter_set_id]->sps_svc_ext, sizeof(sps_svc_ext_t));
     
     if (sps_subset->sps->residual_colour_transform_flag)
     {
-        sh->colour_plane_id = bs_read_u(b, 2);
+        sh->colour_plane_id = bs_read_u2(b);
     }
     
     sh->frame_num = bs_read_u(b, sps_subset->sps->log2_max_frame_num_minus4 + 4 ); // was u(v)
@@ -1383,8 +1489,11 @@ void read_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
         {
             if( sps_subset->sps->chroma_format_idc > 0 )
             {
-                sh_svc_ext->ref_layer_chroma_phase_x_plus1_flag = bs_read_u1(b);
-                sh_svc_ext->ref_layer_chroma_phase_y_plus1 = bs_read_u(b, 2);
+                {
+                    uint32_t fused = bs_read_u3(b);
+                    sh_svc_ext->ref_layer_chroma_phase_x_plus1_flag = fused >> 2;
+                    sh_svc_ext->ref_layer_chroma_phase_y_plus1 = fused & 0x3;
+                }
             }
             
             sh_svc_ext->scaled_ref_layer_left_offset = bs_read_se(b);
@@ -1430,8 +1539,11 @@ void read_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     
     if( !sps_subset->sps_svc_ext->slice_header_restriction_flag && !sh_svc_ext->slice_skip_flag )
     {
-        sh_svc_ext->scan_idx_start = bs_read_u(b, 4);
-        sh_svc_ext->scan_idx_end = bs_read_u(b, 4);
+        {
+            uint32_t fused = bs_read_u8(b);
+            sh_svc_ext->scan_idx_start = fused >> 4;
+            sh_svc_ext->scan_idx_end = fused & 0xF;
+        }
     }
 }
 
@@ -1452,7 +1564,7 @@ void read_dec_ref_base_pic_marking(nal_t* nal, bs_t* b)
             {
                 nal->prefix_nal_svc->long_term_base_pic_num = bs_read_ue(b);
             }
-        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 );
+        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 && ! bs_error(b) );
     }
 }
 
@@ -1494,21 +1606,39 @@ int write_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
     int nal_size = size;
     int rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    uint8_t* rbsp_buf;
+    bs_t bs;
+    bs_t* b;
+
+    // whatever was read from the last NAL is released, see h264_arena_t
+    h264_arena_reset(&h->arena);
+    h->slice_data->rbsp_buf = NULL;
+    h->slice_data->rbsp_size = 0;
 
     if( 0 )
     {
-        int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+        // the RBSP is produced as the parser reads it, so for a slice only the header is copied here
+        rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, rbsp_size + BS_PADDING);
+        b = bs_init_nal(&bs, rbsp_buf, buf, nal_size);
 
-        if (rc < 0) { free(rbsp_buf); return -1; } // handle conversion error
+        // other NALs are small, convert them whole and reject bad ones before parsing anything
+        int nal_unit_type = (size > 0) ? (buf[0] & 0x1F) : 0;
+        if( nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_AUX &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION )
+        {
+            bs_unescape_all(b);
+            if (bs_error(b)) { return -1; } // handle conversion error
+        }
     }
-
-    if( 1 )
+    else
     {
-        rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
+        // the RBSP is written straight into buf after the first byte, and escaped in place at the end
+        rbsp_size = (size > 1) ? size - 1 : 0;
+        b = bs_init(&bs, buf + 1, rbsp_size);
     }
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
     /* forbidden_zero_bit */ bs_write_u(b, 1, 0);
     bs_write_u(b, 2, nal->nal_ref_idc);
     bs_write_u(b, 5, nal->nal_unit_type);
@@ -1546,12 +1676,14 @@ int write_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 #endif
 
         case NAL_UNIT_TYPE_SPS: 
+            if( 0 ) { h->sps = h->sps_buf; }
             write_seq_parameter_set_rbsp(h->sps, b);
             write_rbsp_trailing_bits(b);
             
             if( 0 )
             {
-                memcpy(h->sps_table[h->sps->seq_parameter_set_id], h->sps, sizeof(sps_t));
+                sps_t* sps_entry = h264_sps_table_put(h, h->sps);
+                if( sps_entry != NULL ) { h->sps = sps_entry; }
             }
 
             break;
@@ -1578,15 +1710,20 @@ int write_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
         //SVC support
         case NAL_UNIT_TYPE_SUBSET_SPS:
+            if( 0 ) { h->sps_subset = h->sps_subset_buf; }
             write_subset_seq_parameter_set_rbsp(h->sps_subset, b);
             write_rbsp_trailing_bits(b);
             
             if( 0 )
             {
-                memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id], h->sps_subset, sizeof(sps_subset_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps, h->sps_subset->sps, sizeof(sps_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
-                //h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                sps_subset_t* sps_subset_entry = h264_sps_subset_table_entry(h, h->sps_subset->sps->seq_parameter_set_id);
+                if( sps_subset_entry != NULL )
+                {
+                    memcpy(sps_subset_entry->sps, h->sps_subset->sps, sizeof(sps_t));
+                    memcpy(sps_subset_entry->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
+                    sps_subset_entry->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                    h->sps_subset = sps_subset_entry;
+                }
             }
 
             break;
@@ -1613,19 +1750,28 @@ int write_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
             return -1;
     }
 
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if( 0 )
+    {
+        // anything the parser did not reach is still checked for forbidden sequences
+        bs_unescape_all(b);
+        nal_size = b->src_p - buf;
+    }
+
+    if (bs_overrun(b) || bs_error(b)) { return -1; }
 
     if( 1 )
     {
         // now get the actual size used
-        rbsp_size = bs_pos(b);
+        rbsp_size = bs_write_finalize(b);
 
-        int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf, &nal_size);
-        if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
-    }
+        // make room for the emulation prevention bytes before the RBSP, rbsp_to_nal then fills it in going forward
+        int n = rbsp_to_nal_size(buf + 1, rbsp_size) - rbsp_size - 1;
+        if (rbsp_size + n + 1 > size) { return -1; }
+        if (n > 0) { memmove(buf + 1 + n, buf + 1, rbsp_size); }
 
-    bs_free(b);
-    free(rbsp_buf);
+        int rc = rbsp_to_nal(buf + 1 + n, &rbsp_size, buf, &nal_size);
+        if (rc < 0) { return -1; }
+    }
 
     return nal_size;
 }
@@ -1724,7 +1870,7 @@ void write_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         bs_write_u1(b, sps->seq_scaling_matrix_present_flag);
         if( sps->seq_scaling_matrix_present_flag )
         {
-            for( i = 0; i < 8; i++ )
+            for( i = 0; i < ((sps->chroma_format_idc != 3) ? 8 : 12); i++ )
             {
                 bs_write_u1(b, sps->seq_scaling_list_present_flag[ i ]);
                 if( sps->seq_scaling_list_present_flag[ i ] )
@@ -1755,7 +1901,7 @@ void write_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         bs_write_se(b, sps->offset_for_non_ref_pic);
         bs_write_se(b, sps->offset_for_top_to_bottom_field);
         bs_write_ue(b, sps->num_ref_frames_in_pic_order_cnt_cycle);
-        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; i++ )
+        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle && i < 256 && ! bs_error(b); i++ )
         {
             bs_write_se(b, sps->offset_for_ref_frame[ i ]);
         }
@@ -1792,7 +1938,7 @@ void write_scaling_list(bs_t* b, int* scalingList, int sizeOfScalingList, int* u
     int lastScale = 8;
     int nextScale = 8;
     int delta_scale;
-    for( int j = 0; j < sizeOfScalingList; j++ )
+    for( int j = 0; j < sizeOfScalingList && ! bs_error(b); j++ )
     {
         if( nextScale != 0 )
         {
@@ -1890,7 +2036,7 @@ void write_seq_parameter_set_svc_extension(sps_subset_t* sps_subset, bs_t* b)
 void write_svc_vui_parameters_extension(sps_svc_ext_t* sps_svc_ext, bs_t* b)
 {
     bs_write_ue(b, sps_svc_ext->vui.vui_ext_num_entries_minus1);
-    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1; i++ )
+    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1 && i < MAX_J && ! bs_error(b); i++ )
     {
         bs_write_u(b, 3, sps_svc_ext->vui.vui_ext_dependency_id[i]);
         bs_write_u(b, 4, sps_svc_ext->vui.vui_ext_quality_id[i]);
@@ -2002,7 +2148,7 @@ void write_hrd_parameters(hrd_t* hrd, bs_t* b)
     bs_write_ue(b, hrd->cpb_cnt_minus1);
     bs_write_u(b, 4, hrd->bit_rate_scale);
     bs_write_u(b, 4, hrd->cpb_size_scale);
-    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1; SchedSelIdx++ )
+    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1 && SchedSelIdx < 32 && ! bs_error(b); SchedSelIdx++ )
     {
         bs_write_ue(b, hrd->bit_rate_value_minus1[ SchedSelIdx ]);
         bs_write_ue(b, hrd->cpb_size_value_minus1[ SchedSelIdx ]);
@@ -2035,11 +2181,12 @@ int write_seq_parameter_set_extension_rbsp(bs_t* b, sps_ext_t* sps_ext) {
 //7.3.2.2 Picture parameter set RBSP syntax
 void write_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 {
-    pps_t* pps = h->pps;
     if( 0 )
     {
-        memset(pps, 0, sizeof(pps_t));
+        h->pps = h->pps_buf;
+        memset(h->pps, 0, sizeof(pps_t));
     }
+    pps_t* pps = h->pps;
 
     bs_write_ue(b, pps->pic_parameter_set_id);
     bs_write_ue(b, pps->seq_parameter_set_id);
@@ -2052,14 +2199,14 @@ void write_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         bs_write_ue(b, pps->slice_group_map_type);
         if( pps->slice_group_map_type == 0 )
         {
-            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 bs_write_ue(b, pps->run_length_minus1[ i_group ]);
             }
         }
         else if( pps->slice_group_map_type == 2 )
         {
-            for( int i_group = 0; i_group < pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group < pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 bs_write_ue(b, pps->top_left[ i_group ]);
                 bs_write_ue(b, pps->bottom_right[ i_group ]);
@@ -2075,7 +2222,7 @@ void write_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         else if( pps->slice_group_map_type == 6 )
         {
             bs_write_ue(b, pps->pic_size_in_map_units_minus1);
-            for( int i = 0; i <= pps->pic_size_in_map_units_minus1; i++ )
+            for( int i = 0; i <= pps->pic_size_in_map_units_minus1 && i < 256 && ! bs_error(b); i++ )
             {
                 int v = intlog2( pps->num_slice_groups_minus1 + 1 );
                 bs_write_u(b, v, pps->slice_group_id[ i ]);
@@ -2106,7 +2253,7 @@ void write_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         bs_write_u1(b, pps->pic_scaling_matrix_present_flag);
         if( pps->pic_scaling_matrix_present_flag )
         {
-            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag; i++ )
+            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag && ! bs_error(b); i++ )
             {
                 bs_write_u1(b, pps->pic_scaling_list_present_flag[ i ]);
                 if( pps->pic_scaling_list_present_flag[ i ] )
@@ -2129,7 +2276,8 @@ void write_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 
     if( 0 )
     {
-        memcpy(h->pps_table[pps->pic_parameter_set_id], h->pps, sizeof(pps_t));
+        pps_t* pps_entry = h264_pps_table_put(h, h->pps);
+        if( pps_entry != NULL ) { h->pps = pps_entry; }
     }
 }
 
@@ -2139,19 +2287,22 @@ void write_sei_rbsp(h264_stream_t* h, bs_t* b)
 {
     if( 0 )
     {
-        for( int i = 0; i < h->num_seis; i++ )
-        {
-            sei_free(h->seis[i]);
-        }
-    
+        // the messages of the last SEI, and those past them, are read into again; seis set up for writing are taken over
+        if( h->seis_capacity < h->num_seis ) { h->seis_capacity = h->num_seis; }
+
         h->num_seis = 0;
         do {
-            h->num_seis++;
-            h->seis = (sei_t**)realloc(h->seis, h->num_seis * sizeof(sei_t*));
-            h->seis[h->num_seis - 1] = sei_new();
-            h->sei = h->seis[h->num_seis - 1];
+            if( h->num_seis == h->seis_capacity )
+            {
+                int capacity = ( h->seis_capacity > 0 ) ? 2 * h->seis_capacity : 4;
+                h->seis = (sei_t**)realloc(h->seis, capacity * sizeof(sei_t*));
+                memset(h->seis + h->seis_capacity, 0, ( capacity - h->seis_capacity ) * sizeof(sei_t*));
+                h->seis_capacity = capacity;
+            }
+            if( h->seis[h->num_seis] == NULL ) { h->seis[h->num_seis] = sei_new(); }
+            h->sei = h->seis[h->num_seis++];
             write_sei_message(h, b);
-        } while( more_rbsp_data(b) );
+        } while( more_rbsp_data(b) && ! bs_error(b) );
     }
 
     if( 1 )
@@ -2201,6 +2352,7 @@ void write_end_of_stream_rbsp(h264_stream_t* h, bs_t* b)
 //7.3.2.7 Filler data RBSP syntax
 void write_filler_data_rbsp(h264_stream_t* h, bs_t* b)
 {
+    if( 0 && !0 ) { bs_skip_run(b, 0xFF); }
     while( bs_next_bits(b, 8) == 0xFF )
     {
         /* ff_byte */ bs_write_u(b, 8, 0xFF);
@@ -2219,14 +2371,38 @@ void write_slice_layer_rbsp(h264_stream_t* h,  bs_t* b)
 
     if ( slice_data != NULL )
     {
-        if ( slice_data->rbsp_buf != NULL ) free( slice_data->rbsp_buf ); 
         uint8_t *sptr = b->p + (!!b->bits_left); // CABAC-specific: skip alignment bits, if there are any
+        int nal_left = 0;
+
+        if( 0 )
+        {
+            // the rest of the NAL is converted straight into slice_data->rbsp_buf, see bs_init_nal
+            bs_need(b, sptr - b->p);
+            nal_left = b->src_end - b->src_p;
+        }
+
         slice_data->rbsp_size = b->end - sptr;
-        
-        slice_data->rbsp_buf = (uint8_t*)malloc(slice_data->rbsp_size);
-        memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
-        // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
-        return;
+
+        if ( slice_data->rbsp_size > 0 || nal_left > 0 )
+        {
+            slice_data->rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, slice_data->rbsp_size + nal_left);
+            memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
+            if ( nal_left > 0 )
+            {
+                int rbsp_left = nal_left;
+                if ( nal_to_rbsp(b->src_p, &nal_left, slice_data->rbsp_buf + slice_data->rbsp_size, &rbsp_left) < 0 ) { b->error = 1; rbsp_left = 0; }
+                slice_data->rbsp_size += rbsp_left;
+                b->src_p += nal_left;
+                b->src_end = b->src_p;
+            }
+            // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
+            return;
+        }
+        else
+        {
+            slice_data->rbsp_buf = NULL;
+            slice_data->rbsp_size = 0;
+        }
     }
 
     // FIXME should read or skip data
@@ -2269,6 +2445,7 @@ void write_rbsp_slice_trailing_bits(h264_stream_t* h, bs_t* b)
     write_rbsp_trailing_bits(b);
     if( h->pps->entropy_coding_mode_flag )
     {
+        if( 0 && !0 ) { bs_skip_run(b, 0x00); }
         while( more_rbsp_trailing_data(h, b) )
         {
             /* cabac_zero_word */ bs_write_u(b, 16, 0x0000);
@@ -2285,6 +2462,11 @@ void write_rbsp_trailing_bits(bs_t* b)
     {
         /* rbsp_alignment_zero_bit */ bs_write_u(b, 1, 0);
     }
+
+    if( 1 )
+    {
+        bs_write_flush(b);
+    }
 }
 
 //7.3.3 Slice header syntax
@@ -2293,7 +2475,7 @@ void write_slice_header(h264_stream_t* h, bs_t* b)
     slice_header_t* sh = h->sh;
     if( 0 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
     }
 
     nal_t* nal = h->nal;
@@ -2302,11 +2484,11 @@ void write_slice_header(h264_stream_t* h, bs_t* b)
     bs_write_ue(b, sh->slice_type);
     bs_write_ue(b, sh->pic_parameter_set_id);
 
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_t* sps = h->sps;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(h->sps, h->sps_table[pps->seq_parameter_set_id], sizeof(sps_t));
 
     if (sps->residual_colour_transform_flag)
     {
@@ -2427,7 +2609,7 @@ void write_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     bs_write_ue(b, sh->rplr.reorder_l0.long_term_pic_num[ n ]);
                 }
-            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
@@ -2449,7 +2631,7 @@ void write_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     bs_write_ue(b, sh->rplr.reorder_l1.long_term_pic_num[ n ]);
                 }
-            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -2463,12 +2645,17 @@ void write_pred_weight_table(h264_stream_t* h, bs_t* b)
 
     int i, j;
 
+    if( 0 )
+    {
+        sh->pwt_read = 1;
+    }
+
     bs_write_ue(b, sh->pwt.luma_log2_weight_denom);
-    if( sps->chroma_format_idc != 0 )
+    if( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
     {
         bs_write_ue(b, sh->pwt.chroma_log2_weight_denom);
     }
-    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1; i++ )
+    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1 && i < 64 && ! bs_error(b); i++ )
     {
         bs_write_u1(b, sh->pwt.luma_weight_l0_flag[i]);
         if( sh->pwt.luma_weight_l0_flag[i] )
@@ -2476,7 +2663,7 @@ void write_pred_weight_table(h264_stream_t* h, bs_t* b)
             bs_write_se(b, sh->pwt.luma_weight_l0[ i ]);
             bs_write_se(b, sh->pwt.luma_offset_l0[ i ]);
         }
-        if ( sps->chroma_format_idc != 0 )
+        if ( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
         {
             bs_write_u1(b, sh->pwt.chroma_weight_l0_flag[i]);
             if( sh->pwt.chroma_weight_l0_flag[i] )
@@ -2491,7 +2678,7 @@ void write_pred_weight_table(h264_stream_t* h, bs_t* b)
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
     {
-        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1; i++ )
+        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1 && i < 64 && ! bs_error(b); i++ )
         {
             bs_write_u1(b, sh->pwt.luma_weight_l1_flag[i]);
             if( sh->pwt.luma_weight_l1_flag[i] )
@@ -2554,7 +2741,7 @@ void write_dec_ref_pic_marking(h264_stream_t* h, bs_t* b)
                 {
                     bs_write_ue(b, sh->drpm.max_long_term_frame_idx_plus1[ n ]);
                 }
-            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && ! bs_eof(b) );
+            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -2566,7 +2753,7 @@ void write_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     slice_header_svc_ext_t* sh_svc_ext = h->sh_svc_ext;
     if( 0 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
         memset(sh_svc_ext, 0, sizeof(slice_header_svc_ext_t));
     }
     
@@ -2576,13 +2763,11 @@ void write_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     bs_write_ue(b, sh->slice_type);
     bs_write_ue(b, sh->pic_parameter_set_id);
     
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps_subset(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_subset_t* sps_subset = h->sps_subset;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(sps_subset, h->sps_subset_table[pps->seq_parameter_set_id], sizeof(sps_subset_t));
-    //memcpy(h->sps_subset->sps, h->sps_subset_table[pps->seq_parameter_set_id]->sps, sizeof(sps_t));
-    //memcpy(h->sps_subset->sps_svc_ext, h->sps_subset_table[pps->seq_parameter_set_id]->sps_svc_ext, sizeof(sps_svc_ext_t));
     
     if (sps_subset->sps->residual_colour_transform_flag)
     {
@@ -2781,7 +2966,7 @@ void write_dec_ref_base_pic_marking(nal_t* nal, bs_t* b)
             {
                 bs_write_ue(b, nal->prefix_nal_svc->long_term_base_pic_num);
             }
-        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 );
+        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 && ! bs_error(b) );
     }
 }
 
@@ -2823,21 +3008,39 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
     int nal_size = size;
     int rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    uint8_t* rbsp_buf;
+    bs_t bs;
+    bs_t* b;
+
+    // whatever was read from the last NAL is released, see h264_arena_t
+    h264_arena_reset(&h->arena);
+    h->slice_data->rbsp_buf = NULL;
+    h->slice_data->rbsp_size = 0;
 
     if( 1 )
     {
-        int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+        // the RBSP is produced as the parser reads it, so for a slice only the header is copied here
+        rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, rbsp_size + BS_PADDING);
+        b = bs_init_nal(&bs, rbsp_buf, buf, nal_size);
 
-        if (rc < 0) { free(rbsp_buf); return -1; } // handle conversion error
+        // other NALs are small, convert them whole and reject bad ones before parsing anything
+        int nal_unit_type = (size > 0) ? (buf[0] & 0x1F) : 0;
+        if( nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_AUX &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION )
+        {
+            bs_unescape_all(b);
+            if (bs_error(b)) { return -1; } // handle conversion error
+        }
     }
-
-    if( 0 )
+    else
     {
-        rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
+        // the RBSP is written straight into buf after the first byte, and escaped in place at the end
+        rbsp_size = (size > 1) ? size - 1 : 0;
+        b = bs_init(&bs, buf + 1, rbsp_size);
     }
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); int forbidden_zero_bit = bs_read_u(b, 1); printf("forbidden_zero_bit: %d \n", forbidden_zero_bit); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); nal->nal_ref_idc = bs_read_u(b, 2); printf("nal->nal_ref_idc: %d \n", nal->nal_ref_idc); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); nal->nal_unit_type = bs_read_u(b, 5); printf("nal->nal_unit_type: %d \n", nal->nal_unit_type); 
@@ -2875,12 +3078,14 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 #endif
 
         case NAL_UNIT_TYPE_SPS: 
+            if( 1 ) { h->sps = h->sps_buf; }
             read_debug_seq_parameter_set_rbsp(h->sps, b);
             read_debug_rbsp_trailing_bits(b);
             
             if( 1 )
             {
-                memcpy(h->sps_table[h->sps->seq_parameter_set_id], h->sps, sizeof(sps_t));
+                sps_t* sps_entry = h264_sps_table_put(h, h->sps);
+                if( sps_entry != NULL ) { h->sps = sps_entry; }
             }
 
             break;
@@ -2907,15 +3112,20 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 
         //SVC support
         case NAL_UNIT_TYPE_SUBSET_SPS:
+            if( 1 ) { h->sps_subset = h->sps_subset_buf; }
             read_debug_subset_seq_parameter_set_rbsp(h->sps_subset, b);
             read_debug_rbsp_trailing_bits(b);
             
             if( 1 )
             {
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id], h->sps_subset, sizeof(sps_subset_t));
-                memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps, h->sps_subset->sps, sizeof(sps_t));
-                memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
-                h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                sps_subset_t* sps_subset_entry = h264_sps_subset_table_entry(h, h->sps_subset->sps->seq_parameter_set_id);
+                if( sps_subset_entry != NULL )
+                {
+                    memcpy(sps_subset_entry->sps, h->sps_subset->sps, sizeof(sps_t));
+                    memcpy(sps_subset_entry->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
+                    sps_subset_entry->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                    h->sps_subset = sps_subset_entry;
+                }
             }
 
             break;
@@ -2942,19 +3152,28 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
             return -1;
     }
 
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if( 1 )
+    {
+        // anything the parser did not reach is still checked for forbidden sequences
+        bs_unescape_all(b);
+        nal_size = b->src_p - buf;
+    }
+
+    if (bs_overrun(b) || bs_error(b)) { return -1; }
 
     if( 0 )
     {
         // now get the actual size used
-        rbsp_size = bs_pos(b);
+        rbsp_size = bs_write_finalize(b);
 
-        int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf, &nal_size);
-        if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
-    }
+        // make room for the emulation prevention bytes before the RBSP, rbsp_to_nal then fills it in going forward
+        int n = rbsp_to_nal_size(buf + 1, rbsp_size) - rbsp_size - 1;
+        if (rbsp_size + n + 1 > size) { return -1; }
+        if (n > 0) { memmove(buf + 1 + n, buf + 1, rbsp_size); }
 
-    bs_free(b);
-    free(rbsp_buf);
+        int rc = rbsp_to_nal(buf + 1 + n, &rbsp_size, buf, &nal_size);
+        if (rc < 0) { return -1; }
+    }
 
     return nal_size;
 }
@@ -3053,7 +3272,7 @@ void read_debug_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->seq_scaling_matrix_present_flag = bs_read_u1(b); printf("sps->seq_scaling_matrix_present_flag: %d \n", sps->seq_scaling_matrix_present_flag); 
         if( sps->seq_scaling_matrix_present_flag )
         {
-            for( i = 0; i < 8; i++ )
+            for( i = 0; i < ((sps->chroma_format_idc != 3) ? 8 : 12); i++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->seq_scaling_list_present_flag[ i ] = bs_read_u1(b); printf("sps->seq_scaling_list_present_flag[ i ]: %d \n", sps->seq_scaling_list_present_flag[ i ]); 
                 if( sps->seq_scaling_list_present_flag[ i ] )
@@ -3084,7 +3303,7 @@ void read_debug_seq_parameter_set_rbsp(sps_t* sps, bs_t* b)
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->offset_for_non_ref_pic = bs_read_se(b); printf("sps->offset_for_non_ref_pic: %d \n", sps->offset_for_non_ref_pic); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->offset_for_top_to_bottom_field = bs_read_se(b); printf("sps->offset_for_top_to_bottom_field: %d \n", sps->offset_for_top_to_bottom_field); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->num_ref_frames_in_pic_order_cnt_cycle = bs_read_ue(b); printf("sps->num_ref_frames_in_pic_order_cnt_cycle: %d \n", sps->num_ref_frames_in_pic_order_cnt_cycle); 
-        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; i++ )
+        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle && i < 256 && ! bs_error(b); i++ )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps->offset_for_ref_frame[ i ] = bs_read_se(b); printf("sps->offset_for_ref_frame[ i ]: %d \n", sps->offset_for_ref_frame[ i ]); 
         }
@@ -3121,7 +3340,7 @@ void read_debug_scaling_list(bs_t* b, int* scalingList, int sizeOfScalingList, i
     int lastScale = 8;
     int nextScale = 8;
     int delta_scale;
-    for( int j = 0; j < sizeOfScalingList; j++ )
+    for( int j = 0; j < sizeOfScalingList && ! bs_error(b); j++ )
     {
         if( nextScale != 0 )
         {
@@ -3219,7 +3438,7 @@ void read_debug_seq_parameter_set_svc_extension(sps_subset_t* sps_subset, bs_t*
 void read_debug_svc_vui_parameters_extension(sps_svc_ext_t* sps_svc_ext, bs_t* b)
 {
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps_svc_ext->vui.vui_ext_num_entries_minus1 = bs_read_ue(b); printf("sps_svc_ext->vui.vui_ext_num_entries_minus1: %d \n", sps_svc_ext->vui.vui_ext_num_entries_minus1); 
-    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1; i++ )
+    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1 && i < MAX_J && ! bs_error(b); i++ )
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps_svc_ext->vui.vui_ext_dependency_id[i] = bs_read_u(b, 3); printf("sps_svc_ext->vui.vui_ext_dependency_id[i]: %d \n", sps_svc_ext->vui.vui_ext_dependency_id[i]); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sps_svc_ext->vui.vui_ext_quality_id[i] = bs_read_u(b, 4); printf("sps_svc_ext->vui.vui_ext_quality_id[i]: %d \n", sps_svc_ext->vui.vui_ext_quality_id[i]); 
@@ -3331,7 +3550,7 @@ void read_debug_hrd_parameters(hrd_t* hrd, bs_t* b)
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); hrd->cpb_cnt_minus1 = bs_read_ue(b); printf("hrd->cpb_cnt_minus1: %d \n", hrd->cpb_cnt_minus1); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); hrd->bit_rate_scale = bs_read_u(b, 4); printf("hrd->bit_rate_scale: %d \n", hrd->bit_rate_scale); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); hrd->cpb_size_scale = bs_read_u(b, 4); printf("hrd->cpb_size_scale: %d \n", hrd->cpb_size_scale); 
-    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1; SchedSelIdx++ )
+    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1 && SchedSelIdx < 32 && ! bs_error(b); SchedSelIdx++ )
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); hrd->bit_rate_value_minus1[ SchedSelIdx ] = bs_read_ue(b); printf("hrd->bit_rate_value_minus1[ SchedSelIdx ]: %d \n", hrd->bit_rate_value_minus1[ SchedSelIdx ]); 
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); hrd->cpb_size_value_minus1[ SchedSelIdx ] = bs_read_ue(b); printf("hrd->cpb_size_value_minus1[ SchedSelIdx ]: %d \n", hrd->cpb_size_value_minus1[ SchedSelIdx ]); 
@@ -3364,11 +3583,12 @@ int read_debug_seq_parameter_set_extension_rbsp(bs_t* b, sps_ext_t* sps_ext) {
 //7.3.2.2 Picture parameter set RBSP syntax
 void read_debug_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 {
-    pps_t* pps = h->pps;
     if( 1 )
     {
-        memset(pps, 0, sizeof(pps_t));
+        h->pps = h->pps_buf;
+        memset(h->pps, 0, sizeof(pps_t));
     }
+    pps_t* pps = h->pps;
 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->pic_parameter_set_id = bs_read_ue(b); printf("pps->pic_parameter_set_id: %d \n", pps->pic_parameter_set_id); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->seq_parameter_set_id = bs_read_ue(b); printf("pps->seq_parameter_set_id: %d \n", pps->seq_parameter_set_id); 
@@ -3381,14 +3601,14 @@ void read_debug_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->slice_group_map_type = bs_read_ue(b); printf("pps->slice_group_map_type: %d \n", pps->slice_group_map_type); 
         if( pps->slice_group_map_type == 0 )
         {
-            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->run_length_minus1[ i_group ] = bs_read_ue(b); printf("pps->run_length_minus1[ i_group ]: %d \n", pps->run_length_minus1[ i_group ]); 
             }
         }
         else if( pps->slice_group_map_type == 2 )
         {
-            for( int i_group = 0; i_group < pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group < pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->top_left[ i_group ] = bs_read_ue(b); printf("pps->top_left[ i_group ]: %d \n", pps->top_left[ i_group ]); 
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->bottom_right[ i_group ] = bs_read_ue(b); printf("pps->bottom_right[ i_group ]: %d \n", pps->bottom_right[ i_group ]); 
@@ -3404,7 +3624,7 @@ void read_debug_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         else if( pps->slice_group_map_type == 6 )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->pic_size_in_map_units_minus1 = bs_read_ue(b); printf("pps->pic_size_in_map_units_minus1: %d \n", pps->pic_size_in_map_units_minus1); 
-            for( int i = 0; i <= pps->pic_size_in_map_units_minus1; i++ )
+            for( int i = 0; i <= pps->pic_size_in_map_units_minus1 && i < 256 && ! bs_error(b); i++ )
             {
                 int v = intlog2( pps->num_slice_groups_minus1 + 1 );
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->slice_group_id[ i ] = bs_read_u(b, v); printf("pps->slice_group_id[ i ]: %d \n", pps->slice_group_id[ i ]); 
@@ -3435,7 +3655,7 @@ void read_debug_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->pic_scaling_matrix_present_flag = bs_read_u1(b); printf("pps->pic_scaling_matrix_present_flag: %d \n", pps->pic_scaling_matrix_present_flag); 
         if( pps->pic_scaling_matrix_present_flag )
         {
-            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag; i++ )
+            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag && ! bs_error(b); i++ )
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); pps->pic_scaling_list_present_flag[ i ] = bs_read_u1(b); printf("pps->pic_scaling_list_present_flag[ i ]: %d \n", pps->pic_scaling_list_present_flag[ i ]); 
                 if( pps->pic_scaling_list_present_flag[ i ] )
@@ -3458,7 +3678,8 @@ void read_debug_pic_parameter_set_rbsp(h264_stream_t* h, bs_t* b)
 
     if( 1 )
     {
-        memcpy(h->pps_table[pps->pic_parameter_set_id], h->pps, sizeof(pps_t));
+        pps_t* pps_entry = h264_pps_table_put(h, h->pps);
+        if( pps_entry != NULL ) { h->pps = pps_entry; }
     }
 }
 
@@ -3468,19 +3689,22 @@ void read_debug_sei_rbsp(h264_stream_t* h, bs_t* b)
 {
     if( 1 )
     {
-        for( int i = 0; i < h->num_seis; i++ )
-        {
-            sei_free(h->seis[i]);
-        }
-    
+        // the messages of the last SEI, and those past them, are read into again; seis set up for writing are taken over
+        if( h->seis_capacity < h->num_seis ) { h->seis_capacity = h->num_seis; }
+
         h->num_seis = 0;
         do {
-            h->num_seis++;
-            h->seis = (sei_t**)realloc(h->seis, h->num_seis * sizeof(sei_t*));
-            h->seis[h->num_seis - 1] = sei_new();
-            h->sei = h->seis[h->num_seis - 1];
+            if( h->num_seis == h->seis_capacity )
+            {
+                int capacity = ( h->seis_capacity > 0 ) ? 2 * h->seis_capacity : 4;
+                h->seis = (sei_t**)realloc(h->seis, capacity * sizeof(sei_t*));
+                memset(h->seis + h->seis_capacity, 0, ( capacity - h->seis_capacity ) * sizeof(sei_t*));
+                h->seis_capacity = capacity;
+            }
+            if( h->seis[h->num_seis] == NULL ) { h->seis[h->num_seis] = sei_new(); }
+            h->sei = h->seis[h->num_seis++];
             read_debug_sei_message(h, b);
-        } while( more_rbsp_data(b) );
+        } while( more_rbsp_data(b) && ! bs_error(b) );
     }
 
     if( 0 )
@@ -3530,6 +3754,7 @@ void read_debug_end_of_stream_rbsp(h264_stream_t* h, bs_t* b)
 //7.3.2.7 Filler data RBSP syntax
 void read_debug_filler_data_rbsp(h264_stream_t* h, bs_t* b)
 {
+    if( 1 && !1 ) { bs_skip_run(b, 0xFF); }
     while( bs_next_bits(b, 8) == 0xFF )
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); int ff_byte = bs_read_u(b, 8); printf("ff_byte: %d \n", ff_byte); 
@@ -3548,14 +3773,30 @@ void read_debug_slice_layer_rbsp(h264_stream_t* h,  bs_t* b)
 
     if ( slice_data != NULL )
     {
-        if ( slice_data->rbsp_buf != NULL ) free( slice_data->rbsp_buf ); 
         uint8_t *sptr = b->p + (!!b->bits_left); // CABAC-specific: skip alignment bits, if there are any
+        int nal_left = 0;
+
+        if( 1 )
+        {
+            // the rest of the NAL is converted straight into slice_data->rbsp_buf, see bs_init_nal
+            bs_need(b, sptr - b->p);
+            nal_left = b->src_end - b->src_p;
+        }
+
         slice_data->rbsp_size = b->end - sptr;
 
-        if ( slice_data->rbsp_size > 0 )
+        if ( slice_data->rbsp_size > 0 || nal_left > 0 )
         {
-            slice_data->rbsp_buf = (uint8_t*)malloc(slice_data->rbsp_size);
+            slice_data->rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, slice_data->rbsp_size + nal_left);
             memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
+            if ( nal_left > 0 )
+            {
+                int rbsp_left = nal_left;
+                if ( nal_to_rbsp(b->src_p, &nal_left, slice_data->rbsp_buf + slice_data->rbsp_size, &rbsp_left) < 0 ) { b->error = 1; rbsp_left = 0; }
+                slice_data->rbsp_size += rbsp_left;
+                b->src_p += nal_left;
+                b->src_end = b->src_p;
+            }
             // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
             return;
         }
@@ -3606,6 +3847,7 @@ void read_debug_rbsp_slice_trailing_bits(h264_stream_t* h, bs_t* b)
     read_debug_rbsp_trailing_bits(b);
     if( h->pps->entropy_coding_mode_flag )
     {
+        if( 1 && !1 ) { bs_skip_run(b, 0x00); }
         while( more_rbsp_trailing_data(h, b) )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); int cabac_zero_word = bs_read_u(b, 16); printf("cabac_zero_word: %d \n", cabac_zero_word); 
@@ -3622,6 +3864,11 @@ void read_debug_rbsp_trailing_bits(bs_t* b)
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); int rbsp_alignment_zero_bit = bs_read_u(b, 1); printf("rbsp_alignment_zero_bit: %d \n", rbsp_alignment_zero_bit); 
     }
+
+    if( 0 )
+    {
+        bs_write_flush(b);
+    }
 }
 
 //7.3.3 Slice header syntax
@@ -3630,7 +3877,7 @@ void read_debug_slice_header(h264_stream_t* h, bs_t* b)
     slice_header_t* sh = h->sh;
     if( 1 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
     }
 
     nal_t* nal = h->nal;
@@ -3639,17 +3886,17 @@ void read_debug_slice_header(h264_stream_t* h, bs_t* b)
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->slice_type = bs_read_ue(b); printf("sh->slice_type: %d \n", sh->slice_type); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pic_parameter_set_id = bs_read_ue(b); printf("sh->pic_parameter_set_id: %d \n", sh->pic_parameter_set_id); 
 
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_t* sps = h->sps;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(h->sps, h->sps_table[pps->seq_parameter_set_id], sizeof(sps_t));
 
     if (sps->residual_colour_transform_flag)
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->colour_plane_id = bs_read_u(b, 2); printf("sh->colour_plane_id: %d \n", sh->colour_plane_id); 
     }
-
+    
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->frame_num = bs_read_u(b, sps->log2_max_frame_num_minus4 + 4 ); printf("sh->frame_num: %d \n", sh->frame_num);  // was u(v)
     if( !sps->frame_mbs_only_flag )
     {
@@ -3764,7 +4011,7 @@ void read_debug_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->rplr.reorder_l0.long_term_pic_num[ n ] = bs_read_ue(b); printf("sh->rplr.reorder_l0.long_term_pic_num[ n ]: %d \n", sh->rplr.reorder_l0.long_term_pic_num[ n ]); 
                 }
-            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
@@ -3786,7 +4033,7 @@ void read_debug_ref_pic_list_reordering(h264_stream_t* h, bs_t* b)
                 {
                     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->rplr.reorder_l1.long_term_pic_num[ n ] = bs_read_ue(b); printf("sh->rplr.reorder_l1.long_term_pic_num[ n ]: %d \n", sh->rplr.reorder_l1.long_term_pic_num[ n ]); 
                 }
-            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -3800,12 +4047,17 @@ void read_debug_pred_weight_table(h264_stream_t* h, bs_t* b)
 
     int i, j;
 
+    if( 1 )
+    {
+        sh->pwt_read = 1;
+    }
+
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pwt.luma_log2_weight_denom = bs_read_ue(b); printf("sh->pwt.luma_log2_weight_denom: %d \n", sh->pwt.luma_log2_weight_denom); 
     if( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pwt.chroma_log2_weight_denom = bs_read_ue(b); printf("sh->pwt.chroma_log2_weight_denom: %d \n", sh->pwt.chroma_log2_weight_denom); 
     }
-    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1; i++ )
+    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1 && i < 64 && ! bs_error(b); i++ )
     {
         printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pwt.luma_weight_l0_flag[i] = bs_read_u1(b); printf("sh->pwt.luma_weight_l0_flag[i]: %d \n", sh->pwt.luma_weight_l0_flag[i]); 
         if( sh->pwt.luma_weight_l0_flag[i] )
@@ -3828,7 +4080,7 @@ void read_debug_pred_weight_table(h264_stream_t* h, bs_t* b)
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
     {
-        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1; i++ )
+        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1 && i < 64 && ! bs_error(b); i++ )
         {
             printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pwt.luma_weight_l1_flag[i] = bs_read_u1(b); printf("sh->pwt.luma_weight_l1_flag[i]: %d \n", sh->pwt.luma_weight_l1_flag[i]); 
             if( sh->pwt.luma_weight_l1_flag[i] )
@@ -3891,7 +4143,7 @@ void read_debug_dec_ref_pic_marking(h264_stream_t* h, bs_t* b)
                 {
                     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->drpm.max_long_term_frame_idx_plus1[ n ] = bs_read_ue(b); printf("sh->drpm.max_long_term_frame_idx_plus1[ n ]: %d \n", sh->drpm.max_long_term_frame_idx_plus1[ n ]); 
                 }
-            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && ! bs_eof(b) );
+            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -3903,7 +4155,7 @@ void read_debug_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     slice_header_svc_ext_t* sh_svc_ext = h->sh_svc_ext;
     if( 1 )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
         memset(sh_svc_ext, 0, sizeof(slice_header_svc_ext_t));
     }
     
@@ -3913,13 +4165,11 @@ void read_debug_slice_header_in_scalable_extension(h264_stream_t* h, bs_t* b)
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->slice_type = bs_read_ue(b); printf("sh->slice_type: %d \n", sh->slice_type); 
     printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); sh->pic_parameter_set_id = bs_read_ue(b); printf("sh->pic_parameter_set_id: %d \n", sh->pic_parameter_set_id); 
     
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps_subset(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_subset_t* sps_subset = h->sps_subset;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    //memcpy(sps_subset, h->sps_subset_table[pps->seq_parameter_set_id], sizeof(sps_subset_t));
-    memcpy(sps_subset->sps, h->sps_subset_table[pps->seq_parameter_set_id]->sps, sizeof(sps_t));
-    memcpy(sps_subset->sps_svc_ext, h->sps_subset_table[pps->seq_parameter_set_id]->sps_svc_ext, sizeof(sps_svc_ext_t));
     
     if (sps_subset->sps->residual_colour_transform_flag)
     {
@@ -4118,7 +4368,7 @@ void read_debug_dec_ref_base_pic_marking(nal_t* nal, bs_t* b)
             {
                 printf("%ld.%d: ", (long int)(b->p - b->start), b->bits_left); nal->prefix_nal_svc->long_term_base_pic_num = bs_read_ue(b); printf("nal->prefix_nal_svc->long_term_base_pic_num: %d \n", nal->prefix_nal_svc->long_term_base_pic_num); 
             }
-        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 );
+        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 && ! bs_error(b) );
     }
 }
 
@@ -58,6 +58,20 @@ typedef struct
 */
 typedef struct
 {
+    // what slice headers and slice data refer to comes first, so that reading a slice touches the start of the SPS only
+    int seq_parameter_set_id;
+    int chroma_format_idc;
+    int residual_colour_transform_flag;
+    int log2_max_frame_num_minus4;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb_minus4;
+    int delta_pic_order_always_zero_flag;
+    int frame_mbs_only_flag;
+    int mb_adaptive_frame_field_flag;
+    int direct_8x8_inference_flag;
+    int pic_width_in_mbs_minus1;
+    int pic_height_in_map_units_minus1;
+
     int profile_idc;
     int constraint_set0_flag;
     int constraint_set1_flag;
@@ -67,33 +81,15 @@ typedef struct
     int constraint_set5_flag;
     int reserved_zero_2bits;
     int level_idc;
-    int seq_parameter_set_id;
-    int chroma_format_idc;
-    int residual_colour_transform_flag;
     int bit_depth_luma_minus8;
     int bit_depth_chroma_minus8;
     int qpprime_y_zero_transform_bypass_flag;
     int seq_scaling_matrix_present_flag;
-      int seq_scaling_list_present_flag[12];
-      int ScalingList4x4[6][16];
-      int UseDefaultScalingMatrix4x4Flag[6];
-      int ScalingList8x8[6][64];
-      int UseDefaultScalingMatrix8x8Flag[6];
-    int log2_max_frame_num_minus4;
-    int pic_order_cnt_type;
-    int log2_max_pic_order_cnt_lsb_minus4;
-    int delta_pic_order_always_zero_flag;
     int offset_for_non_ref_pic;
     int offset_for_top_to_bottom_field;
     int num_ref_frames_in_pic_order_cnt_cycle;
-    int offset_for_ref_frame[256];
     int num_ref_frames;
     int gaps_in_frame_num_value_allowed_flag;
-    int pic_width_in_mbs_minus1;
-    int pic_height_in_map_units_minus1;
-    int frame_mbs_only_flag;
-    int mb_adaptive_frame_field_flag;
-    int direct_8x8_inference_flag;
     int frame_cropping_flag;
     int frame_crop_left_offset;
     int frame_crop_right_offset;
@@ -136,7 +132,15 @@ typedef struct
         int num_reorder_frames;
         int max_dec_frame_buffering;
     } vui;
-    
+
+    // the large tables go last
+    int seq_scaling_list_present_flag[12]; // if seq_scaling_matrix_present_flag
+    int ScalingList4x4[6][16];
+    int UseDefaultScalingMatrix4x4Flag[6];
+    int ScalingList8x8[6][64];
+    int UseDefaultScalingMatrix8x8Flag[6];
+    int offset_for_ref_frame[256];
+
     hrd_t hrd_nal;
     hrd_t hrd_vcl;
 
@@ -210,41 +214,45 @@ typedef struct
 */
 typedef struct 
 {
+    // what slice headers and slice data refer to comes first, as in sps_t
     int pic_parameter_set_id;
     int seq_parameter_set_id;
     int entropy_coding_mode_flag;
     int pic_order_present_flag;
     int num_slice_groups_minus1;
     int slice_group_map_type;
-    int run_length_minus1[8]; // up to num_slice_groups_minus1, which is <= 7 in Baseline and Extended, 0 otheriwse
-    int top_left[8];
-    int bottom_right[8];
-    int slice_group_change_direction_flag;
     int slice_group_change_rate_minus1;
     int pic_size_in_map_units_minus1;
-    int slice_group_id[256]; // FIXME what size?
     int num_ref_idx_l0_active_minus1;
     int num_ref_idx_l1_active_minus1;
     int weighted_pred_flag;
     int weighted_bipred_idc;
+    int deblocking_filter_control_present_flag;
+    int redundant_pic_cnt_present_flag;
+    int transform_8x8_mode_flag;
+
+    int slice_group_change_direction_flag;
     int pic_init_qp_minus26;
     int pic_init_qs_minus26;
     int chroma_qp_index_offset;
-    int deblocking_filter_control_present_flag;
     int constrained_intra_pred_flag;
-    int redundant_pic_cnt_present_flag;
 
     // set iff we carry any of the optional headers
     int _more_rbsp_data_present;
 
-    int transform_8x8_mode_flag;
     int pic_scaling_matrix_present_flag;
-       int pic_scaling_list_present_flag[8];
-       int ScalingList4x4[6][16];
-       int UseDefaultScalingMatrix4x4Flag[6];
-       int ScalingList8x8[2][64];
-       int UseDefaultScalingMatrix8x8Flag[2];
     int second_chroma_qp_index_offset;
+
+    // the large tables go last
+    int run_length_minus1[8]; // up to num_slice_groups_minus1, which is <= 7 in Baseline and Extended, 0 otheriwse
+    int top_left[8];
+    int bottom_right[8];
+    int slice_group_id[256]; // FIXME what size?
+    int pic_scaling_list_present_flag[8]; // if pic_scaling_matrix_present_flag
+    int ScalingList4x4[6][16];
+    int UseDefaultScalingMatrix4x4Flag[6];
+    int ScalingList8x8[2][64];
+    int UseDefaultScalingMatrix8x8Flag[2];
 } pps_t;
 
 
@@ -282,7 +290,10 @@ typedef struct
     int slice_beta_offset_div2;
     int slice_group_change_cycle;
 
+    // not a syntax element: set when pwt is read, so that h264_slice_header_clear only clears pwt if it was
+    int pwt_read;
 
+    // the tables below are several kilobytes, and most slices have none of them; see h264_slice_header_clear
     struct
     {
         int luma_log2_weight_denom;
@@ -495,9 +506,27 @@ typedef struct
 typedef struct
 {
     int rbsp_size;
-    uint8_t* rbsp_buf;
+    uint8_t* rbsp_buf;      // when read, points into h264_stream_t.arena and is valid until the next NAL is read or written
 } slice_data_rbsp_t;
 
+/**
+   Memory for what is read from one NAL, all released at once when the next NAL is read or written.
+   Allocations are bumped off one block; what does not fit gets a block of its own until the next reset, which then
+   replaces the block with one big enough for it all, so that once the largest NALs have been seen no heap memory
+   is allocated or freed per NAL.  SEI messages, read when built with HAVE_SEI, last until the next SEI is read
+   instead, so they are kept in h264_stream_t.seis and read into again.
+*/
+typedef struct
+{
+    uint8_t* buf;
+    size_t size;
+    size_t used;            // bytes asked for since the last reset, which may be more than size
+    void* extra;            // blocks allocated since the last reset because buf was full, chained by their first pointer
+} h264_arena_t;
+
+// parameter sets shared by several streams, see h264_ps_store.h
+typedef struct h264_ps_store h264_ps_store_t;
+
 /**
    H264 stream
    Contains data structures for all NAL types that can be handled by this library.  
@@ -508,7 +537,7 @@ typedef struct
 typedef struct
 {
     nal_t* nal;
-    sps_t* sps;
+    sps_t* sps;                // the active SPS, PPS and subset SPS: entries of the tables below once a slice has been read
     sps_subset_t* sps_subset;  // refer to subset
     pps_t* pps;
     aud_t* aud;
@@ -519,23 +548,148 @@ typedef struct
     
     slice_data_rbsp_t* slice_data;
     
+    // parameter sets seen so far, by id; NULL until one with that id is read
     sps_t* sps_table[32];
     sps_subset_t* sps_subset_table[64];  //refer to base SPS
     pps_t* pps_table[256];
     sei_t** seis;
+    int seis_capacity;          // entries of seis; those past num_seis are NULL or messages kept for the next SEI
+
+    // owned by the stream: where parameter sets are read before going into the tables, and what sps, sps_subset and
+    // pps point to before that or when a slice refers to one which has not been seen
+    sps_t* sps_buf;
+    sps_subset_t* sps_subset_buf;
+    pps_t* pps_buf;
+
+    h264_ps_store_t* ps_store;  // if set, sps_table and pps_table hold references into it; see h264_set_ps_store
 
+    h264_arena_t arena;
 } h264_stream_t;
 
+/**
+   Called by the NAL splitter for each NAL found: size bytes starting at stream offset offset, without the start code.
+   The data is only valid during the call.  Return nonzero to stop splitting.
+*/
+typedef int (*nal_splitter_callback_t)(void* opaque, int64_t offset, uint8_t* nal, int size);
+
+/**
+   Streaming NAL splitter: finds the NALs of an Annex B byte stream which arrives in chunks of any size.
+   A NAL which lies within one chunk is passed to the callback in place; only a NAL which spans chunks is copied.
+   @see nal_splitter_push
+*/
+typedef struct
+{
+    nal_splitter_callback_t callback;
+    void* opaque;
+    int64_t offset;     // stream offset of the next chunk
+    int64_t scan;       // stream offset where the next start code search begins; earlier positions are done
+    int in_nal;         // a start code has been seen and the NAL after it has not ended yet
+    int64_t nal_offset; // stream offset of the first byte of that NAL
+    uint8_t* buf;       // the bytes of that NAL which came in earlier chunks
+    int size;
+    int capacity;
+    int zeros;          // number of 0x00 bytes at the end of the stream so far, up to 2
+} nal_splitter_t;
+
+/**
+   Access unit boundary detection, per 7.4.1.2.3 and 7.4.1.2.4.  Holds what is needed of the NALs seen so far,
+   mostly the slice header fields which tell whether a slice starts a new primary coded picture.
+   @see au_detector_push
+*/
+typedef struct
+{
+    int started;        // a NAL has been seen
+    int end_of_seq;     // the last NAL was an end of sequence or end of stream, so the next one starts an access unit
+    int has_vcl;        // a slice of the primary coded picture has been seen in the current access unit
+    // of the last slice of the primary coded picture
+    int frame_num;
+    int pic_parameter_set_id;
+    int field_pic_flag;
+    int bottom_field_flag;
+    int nal_ref_idc;
+    int pic_order_cnt_type;
+    int pic_order_cnt_lsb;
+    int delta_pic_order_cnt_bottom;
+    int delta_pic_order_cnt[ 2 ];
+    int idr_pic_flag;
+    int idr_pic_id;
+} au_detector_t;
+
+/**
+   One access unit of a byte stream: its NALs, with the start codes between them.
+   @see au_iterator_next
+*/
+typedef struct
+{
+    int64_t offset;     // stream offset of the first byte of the first NAL, after its start code
+    int64_t size;       // up to the end of the last NAL
+    int num_nals;
+} access_unit_t;
+
+/**
+   Iterator over the access units of an Annex B byte stream in a buffer, such as a mapped file.
+   Only the headers of each NAL are read, not slice data.
+   @see au_iterator_next
+*/
+typedef struct
+{
+    h264_stream_t* h;   // holds the parameter sets seen so far, and the headers of the last NAL
+    au_detector_t d;
+    uint8_t* buf;
+    int64_t size;
+    int64_t pos;        // where the search for the next NAL starts
+    int64_t next_offset; // a NAL which has been read and starts the next access unit, -1 if none
+    int64_t next_size;
+} au_iterator_t;
+
 h264_stream_t* h264_new();
 void h264_free(h264_stream_t* h);
+int h264_set_ps_store(h264_stream_t* h, h264_ps_store_t* store);
+
+void* h264_arena_alloc(h264_arena_t* a, size_t size);
+void h264_arena_reset(h264_arena_t* a);
+void h264_arena_free(h264_arena_t* a);
+
+sps_t* h264_sps_table_entry(h264_stream_t* h, int id);
+sps_subset_t* h264_sps_subset_table_entry(h264_stream_t* h, int id);
+pps_t* h264_pps_table_entry(h264_stream_t* h, int id);
+sps_t* h264_sps_table_put(h264_stream_t* h, const sps_t* sps);
+pps_t* h264_pps_table_put(h264_stream_t* h, const pps_t* pps);
+sps_t* h264_sps_table_find(h264_stream_t* h, int id);
+sps_subset_t* h264_sps_subset_table_find(h264_stream_t* h, int id);
+pps_t* h264_pps_table_find(h264_stream_t* h, int id);
+void h264_activate_sps(h264_stream_t* h, int id);
+void h264_activate_sps_subset(h264_stream_t* h, int id);
+void h264_activate_pps(h264_stream_t* h, int id);
+void h264_slice_header_clear(slice_header_t* sh);
 
 int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end);
+int64_t find_nal_unit64(uint8_t* buf, int64_t size, int64_t* nal_start, int64_t* nal_end);
+int find_zero_pair(const uint8_t* buf, int from, int size, uint8_t mask, uint8_t val);
+int64_t find_zero_pair64(const uint8_t* buf, int64_t from, int64_t size, uint8_t mask, uint8_t val);
+
+nal_splitter_t* nal_splitter_new(nal_splitter_callback_t callback, void* opaque);
+void nal_splitter_free(nal_splitter_t* s);
+int nal_splitter_push(nal_splitter_t* s, uint8_t* data, int size);
+int nal_splitter_push64(nal_splitter_t* s, uint8_t* data, int64_t size);
+int nal_splitter_finish(nal_splitter_t* s);
+int nal_splitter_push_file(nal_splitter_t* s, FILE* f);
+
+int au_detector_push(au_detector_t* d, h264_stream_t* h);
+au_iterator_t* au_iterator_new(uint8_t* buf, int64_t size);
+void au_iterator_free(au_iterator_t* it);
+int au_iterator_next(au_iterator_t* it, access_unit_t* au);
 
 int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size);
+int64_t rbsp_to_nal64(const uint8_t* rbsp_buf, const int64_t* rbsp_size, uint8_t* nal_buf, int64_t* nal_size);
+int rbsp_to_nal_size(const uint8_t* rbsp_buf, int rbsp_size);
+int64_t rbsp_to_nal_size64(const uint8_t* rbsp_buf, int64_t rbsp_size);
 int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size);
+int64_t nal_to_rbsp64(const uint8_t* nal_buf, int64_t* nal_size, uint8_t* rbsp_buf, int64_t* rbsp_size);
 
 int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size);
 int peek_nal_unit(h264_stream_t* h, uint8_t* buf, int size);
+int read_nal_unit_headers(h264_stream_t* h, uint8_t* buf, int size);
 
 void read_seq_parameter_set_rbsp(sps_t* sps, bs_t* b);
 void read_scaling_list(bs_t* b, int* scalingList, int sizeOfScalingList, int* useDefaultScalingMatrixFlag );
@@ -63,24 +63,8 @@ int more_rbsp_data(bs_t* bs)
 {
     // TODO this version handles reading only. writing version?
 
-    // no more data
-    if (bs_eof(bs)) { return 0; }
-
-    // no rbsp_stop_bit yet
-    if (bs_peek_u1(bs) == 0) { return 1; }
-
-    // next bit is 1, is it the rsbp_stop_bit? only if the rest of bits are 0
-    bs_t bs_tmp;
-    bs_clone(&bs_tmp, bs);
-    bs_skip_u1(&bs_tmp);
-    while(!bs_eof(&bs_tmp))
-    {
-        // A later bit was 1, it wasn't the rsbp_stop_bit
-        if (bs_read_u1(&bs_tmp) == 1) { return 1; }
-    }
-
-    // All following bits were 0, it was the rsbp_stop_bit
-    return 0;
+    // there is more data if we have not reached the rbsp_stop_bit, which is the last 1 bit in the buffer
+    return bs_before_stop_bit(bs);
 }
 
 int more_rbsp_trailing_data(h264_stream_t* h, bs_t* b) { return !bs_eof(b); }
@@ -137,21 +121,39 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
 
     int nal_size = size;
     int rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    uint8_t* rbsp_buf;
+    bs_t bs;
+    bs_t* b;
+
+    // whatever was read from the last NAL is released, see h264_arena_t
+    h264_arena_reset(&h->arena);
+    h->slice_data->rbsp_buf = NULL;
+    h->slice_data->rbsp_size = 0;
 
     if( is_reading )
     {
-        int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+        // the RBSP is produced as the parser reads it, so for a slice only the header is copied here
+        rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, rbsp_size + BS_PADDING);
+        b = bs_init_nal(&bs, rbsp_buf, buf, nal_size);
 
-        if (rc < 0) { free(rbsp_buf); return -1; } // handle conversion error
+        // other NALs are small, convert them whole and reject bad ones before parsing anything
+        int nal_unit_type = (size > 0) ? (buf[0] & 0x1F) : 0;
+        if( nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_AUX &&
+            nal_unit_type != NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION )
+        {
+            bs_unescape_all(b);
+            if (bs_error(b)) { return -1; } // handle conversion error
+        }
     }
-
-    if( is_writing )
+    else
     {
-        rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
+        // the RBSP is written straight into buf after the first byte, and escaped in place at the end
+        rbsp_size = (size > 1) ? size - 1 : 0;
+        b = bs_init(&bs, buf + 1, rbsp_size);
     }
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
     value( forbidden_zero_bit, f(1, 0) );
     value( nal->nal_ref_idc, u(2) );
     value( nal->nal_unit_type, u(5) );
@@ -189,12 +191,14 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
 #endif
 
         case NAL_UNIT_TYPE_SPS: 
+            if( is_reading ) { h->sps = h->sps_buf; }
             structure(seq_parameter_set_rbsp)(h->sps, b);
             structure(rbsp_trailing_bits)(b);
             
             if( is_reading )
             {
-                memcpy(h->sps_table[h->sps->seq_parameter_set_id], h->sps, sizeof(sps_t));
+                sps_t* sps_entry = h264_sps_table_put(h, h->sps);
+                if( sps_entry != NULL ) { h->sps = sps_entry; }
             }
 
             break;
@@ -221,15 +225,20 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
 
         //SVC support
         case NAL_UNIT_TYPE_SUBSET_SPS:
+            if( is_reading ) { h->sps_subset = h->sps_subset_buf; }
             structure(subset_seq_parameter_set_rbsp)(h->sps_subset, b);
             structure(rbsp_trailing_bits)(b);
             
             if( is_reading )
             {
-                memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id], h->sps_subset, sizeof(sps_subset_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps, h->sps_subset->sps, sizeof(sps_t));
-                //memcpy(h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
-                //h->sps_subset_table[h->sps_subset->sps->seq_parameter_set_id]->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                sps_subset_t* sps_subset_entry = h264_sps_subset_table_entry(h, h->sps_subset->sps->seq_parameter_set_id);
+                if( sps_subset_entry != NULL )
+                {
+                    memcpy(sps_subset_entry->sps, h->sps_subset->sps, sizeof(sps_t));
+                    memcpy(sps_subset_entry->sps_svc_ext, h->sps_subset->sps_svc_ext, sizeof(sps_svc_ext_t));
+                    sps_subset_entry->additional_extension2_flag = h->sps_subset->additional_extension2_flag;
+                    h->sps_subset = sps_subset_entry;
+                }
             }
 
             break;
@@ -256,19 +265,28 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
             return -1;
     }
 
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if( is_reading )
+    {
+        // anything the parser did not reach is still checked for forbidden sequences
+        bs_unescape_all(b);
+        nal_size = b->src_p - buf;
+    }
+
+    if (bs_overrun(b) || bs_error(b)) { return -1; }
 
     if( is_writing )
     {
         // now get the actual size used
-        rbsp_size = bs_pos(b);
+        rbsp_size = bs_write_finalize(b);
 
-        int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf, &nal_size);
-        if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
-    }
+        // make room for the emulation prevention bytes before the RBSP, rbsp_to_nal then fills it in going forward
+        int n = rbsp_to_nal_size(buf + 1, rbsp_size) - rbsp_size - 1;
+        if (rbsp_size + n + 1 > size) { return -1; }
+        if (n > 0) { memmove(buf + 1 + n, buf + 1, rbsp_size); }
 
-    bs_free(b);
-    free(rbsp_buf);
+        int rc = rbsp_to_nal(buf + 1 + n, &rbsp_size, buf, &nal_size);
+        if (rc < 0) { return -1; }
+    }
 
     return nal_size;
 }
@@ -367,7 +385,7 @@ void structure(seq_parameter_set_rbsp)(sps_t* sps, bs_t* b)
         value( sps->seq_scaling_matrix_present_flag, u1 );
         if( sps->seq_scaling_matrix_present_flag )
         {
-            for( i = 0; i < 8; i++ )
+            for( i = 0; i < ((sps->chroma_format_idc != 3) ? 8 : 12); i++ )
             {
                 value( sps->seq_scaling_list_present_flag[ i ], u1 );
                 if( sps->seq_scaling_list_present_flag[ i ] )
@@ -398,7 +416,7 @@ void structure(seq_parameter_set_rbsp)(sps_t* sps, bs_t* b)
         value( sps->offset_for_non_ref_pic, se );
         value( sps->offset_for_top_to_bottom_field, se );
         value( sps->num_ref_frames_in_pic_order_cnt_cycle, ue );
-        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; i++ )
+        for( i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle && i < 256 && ! bs_error(b); i++ )
         {
             value( sps->offset_for_ref_frame[ i ], se );
         }
@@ -435,7 +453,7 @@ void structure(scaling_list)(bs_t* b, int* scalingList, int sizeOfScalingList, i
     int lastScale = 8;
     int nextScale = 8;
     int delta_scale;
-    for( int j = 0; j < sizeOfScalingList; j++ )
+    for( int j = 0; j < sizeOfScalingList && ! bs_error(b); j++ )
     {
         if( nextScale != 0 )
         {
@@ -533,7 +551,7 @@ void structure(seq_parameter_set_svc_extension)(sps_subset_t* sps_subset, bs_t*
 void structure(svc_vui_parameters_extension)(sps_svc_ext_t* sps_svc_ext, bs_t* b)
 {
     value( sps_svc_ext->vui.vui_ext_num_entries_minus1, ue );
-    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1; i++ )
+    for( int i = 0; i <= sps_svc_ext->vui.vui_ext_num_entries_minus1 && i < MAX_J && ! bs_error(b); i++ )
     {
         value( sps_svc_ext->vui.vui_ext_dependency_id[i], u(3) );
         value( sps_svc_ext->vui.vui_ext_quality_id[i], u(4) );
@@ -549,12 +567,12 @@ void structure(svc_vui_parameters_extension)(sps_svc_ext_t* sps_svc_ext, bs_t* b
         value( sps_svc_ext->vui.vui_ext_nal_hrd_parameters_present_flag[i], u1 );
         if( sps_svc_ext->vui.vui_ext_nal_hrd_parameters_present_flag[i] )
         {
-            structure(hrd_parameters)(&sps_svc_ext->hrd_vcl, b);
+            structure(hrd_parameters)(&sps_svc_ext->hrd_vcl[i], b);
         }
         value( sps_svc_ext->vui.vui_ext_vcl_hrd_parameters_present_flag[i], u1 );
         if( sps_svc_ext->vui.vui_ext_vcl_hrd_parameters_present_flag[i] )
         {
-            structure(hrd_parameters)(&sps_svc_ext->hrd_nal, b);
+            structure(hrd_parameters)(&sps_svc_ext->hrd_nal[i], b);
         }
         
         if( sps_svc_ext->vui.vui_ext_nal_hrd_parameters_present_flag[i] ||
@@ -645,7 +663,7 @@ void structure(hrd_parameters)(hrd_t* hrd, bs_t* b)
     value( hrd->cpb_cnt_minus1, ue );
     value( hrd->bit_rate_scale, u(4) );
     value( hrd->cpb_size_scale, u(4) );
-    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1; SchedSelIdx++ )
+    for( int SchedSelIdx = 0; SchedSelIdx <= hrd->cpb_cnt_minus1 && SchedSelIdx < 32 && ! bs_error(b); SchedSelIdx++ )
     {
         value( hrd->bit_rate_value_minus1[ SchedSelIdx ], ue );
         value( hrd->cpb_size_value_minus1[ SchedSelIdx ], ue );
@@ -678,11 +696,12 @@ int structure(seq_parameter_set_extension_rbsp)(bs_t* b, sps_ext_t* sps_ext) {
 //7.3.2.2 Picture parameter set RBSP syntax
 void structure(pic_parameter_set_rbsp)(h264_stream_t* h, bs_t* b)
 {
-    pps_t* pps = h->pps;
     if( is_reading )
     {
-        memset(pps, 0, sizeof(pps_t));
+        h->pps = h->pps_buf;
+        memset(h->pps, 0, sizeof(pps_t));
     }
+    pps_t* pps = h->pps;
 
     value( pps->pic_parameter_set_id, ue);
     value( pps->seq_parameter_set_id, ue );
@@ -695,14 +714,14 @@ void structure(pic_parameter_set_rbsp)(h264_stream_t* h, bs_t* b)
         value( pps->slice_group_map_type, ue );
         if( pps->slice_group_map_type == 0 )
         {
-            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group <= pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 value( pps->run_length_minus1[ i_group ], ue );
             }
         }
         else if( pps->slice_group_map_type == 2 )
         {
-            for( int i_group = 0; i_group < pps->num_slice_groups_minus1; i_group++ )
+            for( int i_group = 0; i_group < pps->num_slice_groups_minus1 && i_group < 8 && ! bs_error(b); i_group++ )
             {
                 value( pps->top_left[ i_group ], ue );
                 value( pps->bottom_right[ i_group ], ue );
@@ -718,7 +737,7 @@ void structure(pic_parameter_set_rbsp)(h264_stream_t* h, bs_t* b)
         else if( pps->slice_group_map_type == 6 )
         {
             value( pps->pic_size_in_map_units_minus1, ue );
-            for( int i = 0; i <= pps->pic_size_in_map_units_minus1; i++ )
+            for( int i = 0; i <= pps->pic_size_in_map_units_minus1 && i < 256 && ! bs_error(b); i++ )
             {
                 int v = intlog2( pps->num_slice_groups_minus1 + 1 );
                 value( pps->slice_group_id[ i ], u(v) );
@@ -749,7 +768,7 @@ void structure(pic_parameter_set_rbsp)(h264_stream_t* h, bs_t* b)
         value( pps->pic_scaling_matrix_present_flag, u1 );
         if( pps->pic_scaling_matrix_present_flag )
         {
-            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag; i++ )
+            for( int i = 0; i < 6 + 2* pps->transform_8x8_mode_flag && ! bs_error(b); i++ )
             {
                 value( pps->pic_scaling_list_present_flag[ i ], u1 );
                 if( pps->pic_scaling_list_present_flag[ i ] )
@@ -772,7 +791,8 @@ void structure(pic_parameter_set_rbsp)(h264_stream_t* h, bs_t* b)
 
     if( is_reading )
     {
-        memcpy(h->pps_table[pps->pic_parameter_set_id], h->pps, sizeof(pps_t));
+        pps_t* pps_entry = h264_pps_table_put(h, h->pps);
+        if( pps_entry != NULL ) { h->pps = pps_entry; }
     }
 }
 
@@ -782,19 +802,22 @@ void structure(sei_rbsp)(h264_stream_t* h, bs_t* b)
 {
     if( is_reading )
     {
-        for( int i = 0; i < h->num_seis; i++ )
-        {
-            sei_free(h->seis[i]);
-        }
-    
+        // the messages of the last SEI, and those past them, are read into again; seis set up for writing are taken over
+        if( h->seis_capacity < h->num_seis ) { h->seis_capacity = h->num_seis; }
+
         h->num_seis = 0;
         do {
-            h->num_seis++;
-            h->seis = (sei_t**)realloc(h->seis, h->num_seis * sizeof(sei_t*));
-            h->seis[h->num_seis - 1] = sei_new();
-            h->sei = h->seis[h->num_seis - 1];
+            if( h->num_seis == h->seis_capacity )
+            {
+                int capacity = ( h->seis_capacity > 0 ) ? 2 * h->seis_capacity : 4;
+                h->seis = (sei_t**)realloc(h->seis, capacity * sizeof(sei_t*));
+                memset(h->seis + h->seis_capacity, 0, ( capacity - h->seis_capacity ) * sizeof(sei_t*));
+                h->seis_capacity = capacity;
+            }
+            if( h->seis[h->num_seis] == NULL ) { h->seis[h->num_seis] = sei_new(); }
+            h->sei = h->seis[h->num_seis++];
             structure(sei_message)(h, b);
-        } while( more_rbsp_data(b) );
+        } while( more_rbsp_data(b) && ! bs_error(b) );
     }
 
     if( is_writing )
@@ -844,6 +867,7 @@ void structure(end_of_stream_rbsp)(h264_stream_t* h, bs_t* b)
 //7.3.2.7 Filler data RBSP syntax
 void structure(filler_data_rbsp)(h264_stream_t* h, bs_t* b)
 {
+    if( is_reading && !is_debug ) { bs_skip_run(b, 0xFF); }
     while( bs_next_bits(b, 8) == 0xFF )
     {
         value( ff_byte, f(8, 0xFF) );
@@ -862,14 +886,38 @@ void structure(slice_layer_rbsp)(h264_stream_t* h,  bs_t* b)
 
     if ( slice_data != NULL )
     {
-        if ( slice_data->rbsp_buf != NULL ) free( slice_data->rbsp_buf ); 
         uint8_t *sptr = b->p + (!!b->bits_left); // CABAC-specific: skip alignment bits, if there are any
+        int nal_left = 0;
+
+        if( is_reading )
+        {
+            // the rest of the NAL is converted straight into slice_data->rbsp_buf, see bs_init_nal
+            bs_need(b, sptr - b->p);
+            nal_left = b->src_end - b->src_p;
+        }
+
         slice_data->rbsp_size = b->end - sptr;
-        
-        slice_data->rbsp_buf = (uint8_t*)malloc(slice_data->rbsp_size);
-        memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
-        // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
-        return;
+
+        if ( slice_data->rbsp_size > 0 || nal_left > 0 )
+        {
+            slice_data->rbsp_buf = (uint8_t*)h264_arena_alloc(&h->arena, slice_data->rbsp_size + nal_left);
+            memcpy( slice_data->rbsp_buf, sptr, slice_data->rbsp_size );
+            if ( nal_left > 0 )
+            {
+                int rbsp_left = nal_left;
+                if ( nal_to_rbsp(b->src_p, &nal_left, slice_data->rbsp_buf + slice_data->rbsp_size, &rbsp_left) < 0 ) { b->error = 1; rbsp_left = 0; }
+                slice_data->rbsp_size += rbsp_left;
+                b->src_p += nal_left;
+                b->src_end = b->src_p;
+            }
+            // ugly hack: since next NALU starts at byte border, we are going to be padded by trailing_bits;
+            return;
+        }
+        else
+        {
+            slice_data->rbsp_buf = NULL;
+            slice_data->rbsp_size = 0;
+        }
     }
 
     // FIXME should read or skip data
@@ -912,6 +960,7 @@ void structure(rbsp_slice_trailing_bits)(h264_stream_t* h, bs_t* b)
     structure(rbsp_trailing_bits)(b);
     if( h->pps->entropy_coding_mode_flag )
     {
+        if( is_reading && !is_debug ) { bs_skip_run(b, 0x00); }
         while( more_rbsp_trailing_data(h, b) )
         {
             value( cabac_zero_word, f(16, 0x0000) );
@@ -928,6 +977,11 @@ void structure(rbsp_trailing_bits)(bs_t* b)
     {
         value( rbsp_alignment_zero_bit, f(1, 0) );
     }
+
+    if( is_writing )
+    {
+        bs_write_flush(b);
+    }
 }
 
 //7.3.3 Slice header syntax
@@ -936,7 +990,7 @@ void structure(slice_header)(h264_stream_t* h, bs_t* b)
     slice_header_t* sh = h->sh;
     if( is_reading )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
     }
 
     nal_t* nal = h->nal;
@@ -945,11 +999,11 @@ void structure(slice_header)(h264_stream_t* h, bs_t* b)
     value( sh->slice_type, ue );
     value( sh->pic_parameter_set_id, ue );
 
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_t* sps = h->sps;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(h->sps, h->sps_table[pps->seq_parameter_set_id], sizeof(sps_t));
 
     if (sps->residual_colour_transform_flag)
     {
@@ -1070,7 +1124,7 @@ void structure(ref_pic_list_reordering)(h264_stream_t* h, bs_t* b)
                 {
                     value( sh->rplr.reorder_l0.long_term_pic_num[ n ], ue );
                 }
-            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l0.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
@@ -1092,7 +1146,7 @@ void structure(ref_pic_list_reordering)(h264_stream_t* h, bs_t* b)
                 {
                     value( sh->rplr.reorder_l1.long_term_pic_num[ n ], ue );
                 }
-            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && ! bs_eof(b) );
+            } while( sh->rplr.reorder_l1.reordering_of_pic_nums_idc[ n ] != 3 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -1106,12 +1160,17 @@ void structure(pred_weight_table)(h264_stream_t* h, bs_t* b)
 
     int i, j;
 
+    if( is_reading )
+    {
+        sh->pwt_read = 1;
+    }
+
     value( sh->pwt.luma_log2_weight_denom, ue );
-    if( sps->chroma_format_idc != 0 )
+    if( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
     {
         value( sh->pwt.chroma_log2_weight_denom, ue );
     }
-    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1; i++ )
+    for( i = 0; i <= pps->num_ref_idx_l0_active_minus1 && i < 64 && ! bs_error(b); i++ )
     {
         value( sh->pwt.luma_weight_l0_flag[i], u1 );
         if( sh->pwt.luma_weight_l0_flag[i] )
@@ -1119,7 +1178,7 @@ void structure(pred_weight_table)(h264_stream_t* h, bs_t* b)
             value( sh->pwt.luma_weight_l0[ i ], se );
             value( sh->pwt.luma_offset_l0[ i ], se );
         }
-        if ( sps->chroma_format_idc != 0 )
+        if ( sps->chroma_format_idc != 0 ) //FIXME ChromaArrayType may differ from chroma_format_idc
         {
             value( sh->pwt.chroma_weight_l0_flag[i], u1 );
             if( sh->pwt.chroma_weight_l0_flag[i] )
@@ -1134,7 +1193,7 @@ void structure(pred_weight_table)(h264_stream_t* h, bs_t* b)
     }
     if( is_slice_type( sh->slice_type, SH_SLICE_TYPE_B ) )
     {
-        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1; i++ )
+        for( i = 0; i <= pps->num_ref_idx_l1_active_minus1 && i < 64 && ! bs_error(b); i++ )
         {
             value( sh->pwt.luma_weight_l1_flag[i], u1 );
             if( sh->pwt.luma_weight_l1_flag[i] )
@@ -1197,7 +1256,7 @@ void structure(dec_ref_pic_marking)(h264_stream_t* h, bs_t* b)
                 {
                     value( sh->drpm.max_long_term_frame_idx_plus1[ n ], ue );
                 }
-            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && ! bs_eof(b) );
+            } while( sh->drpm.memory_management_control_operation[ n ] != 0 && n < 63 && ! bs_eof(b) && ! bs_error(b) );
         }
     }
 }
@@ -1209,7 +1268,7 @@ void structure(slice_header_in_scalable_extension)(h264_stream_t* h, bs_t* b)
     slice_header_svc_ext_t* sh_svc_ext = h->sh_svc_ext;
     if( is_reading )
     {
-        memset(sh, 0, sizeof(slice_header_t));
+        h264_slice_header_clear(sh);
         memset(sh_svc_ext, 0, sizeof(slice_header_svc_ext_t));
     }
     
@@ -1219,13 +1278,11 @@ void structure(slice_header_in_scalable_extension)(h264_stream_t* h, bs_t* b)
     value( sh->slice_type, ue );
     value( sh->pic_parameter_set_id, ue );
     
-    // TODO check existence, otherwise fail
+    // TODO check existence, otherwise fail; for now a parameter set which has not been seen reads as all zeros
+    h264_activate_pps(h, sh->pic_parameter_set_id);
+    h264_activate_sps_subset(h, h->pps->seq_parameter_set_id);
     pps_t* pps = h->pps;
     sps_subset_t* sps_subset = h->sps_subset;
-    memcpy(h->pps, h->pps_table[sh->pic_parameter_set_id], sizeof(pps_t));
-    memcpy(sps_subset, h->sps_subset_table[pps->seq_parameter_set_id], sizeof(sps_subset_t));
-    //memcpy(h->sps_subset->sps, h->sps_subset_table[pps->seq_parameter_set_id]->sps, sizeof(sps_t));
-    //memcpy(h->sps_subset->sps_svc_ext, h->sps_subset_table[pps->seq_parameter_set_id]->sps_svc_ext, sizeof(sps_svc_ext_t));
     
     if (sps_subset->sps->residual_colour_transform_flag)
     {
@@ -1309,7 +1366,7 @@ void structure(slice_header_in_scalable_extension)(h264_stream_t* h, bs_t* b)
                 if( ( nal->nal_svc_ext->use_ref_base_pic_flag || sh_svc_ext->store_ref_base_pic_flag ) &&
                    ( nal->nal_unit_type != 5 ) )
                 {
-                    structure(dec_ref_base_pic_marking)(h, b);
+                    structure(dec_ref_base_pic_marking)(nal, b);
                 }
             }
         }
@@ -1424,7 +1481,7 @@ void structure(dec_ref_base_pic_marking)(nal_t* nal, bs_t* b)
             {
                 value( nal->prefix_nal_svc->long_term_base_pic_num, ue);
             }
-        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 );
+        } while( nal->prefix_nal_svc->memory_management_base_control_operation != 0 && ! bs_error(b) );
     }
 }
 
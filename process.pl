@@ -39,10 +39,15 @@ print $preamble;
 $code =~ s{#function_declarations}{$decl};
 
 $code_read = $code;
+$code_read =~ s{^(\s*) for \s* \( \s* (?:int \s+)? (\w+) \s* = \s* 0 \s* ; \s* \2 \s* (<=?) \s* ([^;]*?) (?: \s* && \s* \2 \s* < \s* (\w+) )? (?: \s* && \s* ! \s* bs_error\(b\) )? \s* ; \s* \2\+\+ \s* \) \s* \{ \s*
+                 value \s* \( \s* ([^,\[]*?) \s* \[ \s* \2 \s* \] \s* , \s* (ue|se) \s* \); \s* \} }
+               { &proc_array_read($6, $7, $3 eq '<' ? $4 : "$4 + 1", $5, $1) }exmg;
+$code_read = &fuse_fields_read($code_read);
 $code_read =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_read($2, $3, $1) }exmg;
 $code_read =~ s{structure\( (\w+) \)}{read_$1}xg;
 $code_read =~ s{is_reading}{1}g;
 $code_read =~ s{is_writing}{0}g;
+$code_read =~ s{is_debug}{0}g;
 print $code_read;
 
 $code_write = $code;
@@ -50,6 +55,7 @@ $code_write =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_write(
 $code_write =~ s{structure\( (\w+) \)}{write_$1}xg;
 $code_write =~ s{is_reading}{0}g;
 $code_write =~ s{is_writing}{1}g;
+$code_write =~ s{is_debug}{0}g;
 print $code_write;
 
 $code_read_debug = $code;
@@ -57,6 +63,7 @@ $code_read_debug =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_r
 $code_read_debug =~ s{structure\( (\w+) \)}{read_debug_$1}xg;
 $code_read_debug =~ s{is_reading}{1}g;
 $code_read_debug =~ s{is_writing}{0}g;
+$code_read_debug =~ s{is_debug}{1}g;
 print $code_read_debug;
 
 sub proc_value_read
@@ -66,7 +73,8 @@ sub proc_value_read
     $values =~ s{\s*$}{};
 
     my $code;
-    if ($values =~ m{u\((.*)\)}) { $code = "$s = bs_read_u(b, $1);"; }
+    if ($values =~ m{^u\((\d+)\)$}) { $code = "$s = " . &read_call($1) . ";"; }
+    elsif ($values =~ m{u\((.*)\)}) { $code = "$s = bs_read_u(b, $1);"; }
     elsif ($values =~ m{f\((\d+),\s*(.*)\)}) { $code = "/* $s */ bs_skip_u(b, $1);"; }
     elsif ($values =~ m{(ue|se|ce|te|me|u8|u1)}) { $code = "$s = bs_read_$1(b);"; }
     elsif ($values eq 'ae') { $code = "$s = bs_read_ae(b);"; }
@@ -80,6 +88,79 @@ sub proc_value_read
     return $indent . $code;
 }
 
+# a plain loop over an array of ue/se values, with an optional bound on the number read
+sub proc_array_read
+{
+    my ($s, $values, $count, $max, $indent) = @_;
+    if (defined $max) { $count = "($count < $max) ? $count : $max"; }
+    return $indent . "bs_read_${values}_array(b, $s, $count);";
+}
+
+sub read_call
+{
+    my ($n) = @_;
+    # widths which have a specialized reader in bs.h
+    my %widths = map { $_ => 1 } (1, 2, 3, 4, 5, 6, 7, 8, 16, 24, 32);
+    return "bs_read_u$n(b)" if $widths{$n};
+    return "bs_read_un(b, $n)";
+}
+
+# runs of consecutive constant-width fields are read with one call, and each field is then
+# extracted with a shift and mask; a run is split so that no single read is over 32 bits
+sub fuse_fields_read
+{
+    my ($code) = @_;
+    my @out;
+    my @run;
+    my $run_indent;
+
+    my $flush = sub
+    {
+        while (@run)
+        {
+            my @chunk;
+            my $total = 0;
+            while (@run && $total + $run[0]{width} <= 32) { $total += $run[0]{width}; push @chunk, shift @run; }
+
+            if (@chunk == 1) { push @out, $chunk[0]{line}; next; }
+
+            my $i = $run_indent;
+            push @out, "${i}{";
+            push @out, "${i}    uint32_t fused = " . &read_call($total) . ";";
+            my $shift = $total;
+            my $first = 1;
+            foreach my $f (@chunk)
+            {
+                $shift -= $f->{width};
+                if ($f->{skip}) { push @out, "${i}    /* $f->{name} */"; $first = 0; next; }
+                my $e = ($shift > 0) ? "fused >> $shift" : "fused";
+                $e = sprintf("%s & 0x%X", ($shift > 0) ? "(fused >> $shift)" : "fused", (1 << $f->{width}) - 1) unless $first;
+                push @out, "${i}    $f->{name} = $e;";
+                $first = 0;
+            }
+            push @out, "${i}}";
+        }
+    };
+
+    foreach my $line (split /\n/, $code, -1)
+    {
+        if ($line =~ m{^(\s*) value \s* \( \s* ([^,]*?) \s* , \s* (u1|u8|u\((\d+)\)|f\((\d+),\s*[^)]*\)) \s* \); \s*$}x)
+        {
+            my ($indent, $name, $values) = ($1, $2, $3);
+            my $width = ($values eq 'u1') ? 1 : ($values eq 'u8') ? 8 : defined($4) ? $4 : $5;
+            $flush->() if (@run && $indent ne $run_indent);
+            $run_indent = $indent;
+            push @run, { line => $line, name => $name, width => $width, skip => ($values =~ m{^f}) ? 1 : 0 };
+            next;
+        }
+        $flush->();
+        push @out, $line;
+    }
+    $flush->();
+
+    return join("\n", @out);
+}
+
 sub proc_value_read_debug
 {
     my ($s, $values, $indent) = @_;
@@ -98,7 +179,7 @@ sub proc_value_read_debug
         $code = "if (cabac) { $s = bs_read_ae(b); }" . "\n${indent}" . "else { $code }";
     }
 
-    $code = "printf(\"\%d.\%d: \", b->p - b->start, b->bits_left); ".
+    $code = "printf(\"\%ld.\%d: \", (long int)(b->p - b->start), b->bits_left); ".
         $code .
         " printf(\"$s: \%d \\n\", $s); ";
 
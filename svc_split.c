@@ -16,13 +16,142 @@
 #include <string.h>
 #include <errno.h>
 
-#define BUFSIZE 32*1024*1024
 
-int main(int argc, char *argv[])
+// as many as the PPS and subset SPS tables of h264_stream_t hold; NALs with other ids go to the misc file
+#define NUM_PPS_IDS 256
+#define NUM_SPS_SUBSET_IDS 64
+
+typedef struct
+{
+    h264_stream_t* h;
+    const char* fname;
+    FILE* outfile_base;
+    FILE* outfile_misc;
+    //scalable layer, by subset SPS id
+    FILE* outfile_layers[NUM_SPS_SUBSET_IDS];
+    //this is to identify whether pps is written or not, by PPS id
+    uint8_t* pps_buf[NUM_PPS_IDS];
+    int pps_buf_size[NUM_PPS_IDS];
+} svc_split_ctx_t;
+
+static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+static void write_nal(FILE* f, uint8_t* nal, int size)
+{
+    fwrite(start_code, 1, sizeof(start_code), f);
+    fwrite(nal, 1, size, f);
+}
+
+// the layer file of a subset SPS id, NULL if it is out of range or no subset SPS with it has been seen
+static FILE* layer_file(svc_split_ctx_t* ctx, int sps_id)
 {
-    uint8_t* buf = (uint8_t*)malloc( BUFSIZE );
+    if (sps_id < 0 || sps_id >= NUM_SPS_SUBSET_IDS) { return NULL; }
+    return ctx->outfile_layers[sps_id];
+}
+
+// write the PPS a slice refers to before its first slice
+static void write_pps(svc_split_ctx_t* ctx, FILE* f, int pps_id)
+{
+    if (pps_id < 0 || pps_id >= NUM_PPS_IDS || ctx->pps_buf[pps_id] == NULL) { return; }
+    write_nal(f, ctx->pps_buf[pps_id], ctx->pps_buf_size[pps_id]);
+    free(ctx->pps_buf[pps_id]);
+    ctx->pps_buf[pps_id] = NULL;
+}
+
+static int split_nal(void* opaque, int64_t offset, uint8_t* nal, int size)
+{
+    svc_split_ctx_t* ctx = (svc_split_ctx_t*)opaque;
+    h264_stream_t* h = ctx->h;
+    char fname_buf[1024] = {0};
+    int id;
+    FILE* layer;
+
+    fprintf( h264_dbgfile, "!! Found NAL at offset %lld (0x%04llX), size %lld (0x%04llX) \n",
+                (long long int)offset,
+                (long long int)offset,
+                (long long int)size,
+                (long long int)size );
+    
+    fprintf( h264_dbgfile, "XX ");
+    debug_bytes(nal, size >= 16 ? 16: size);
     
-    h264_stream_t* h = h264_new();
+    read_debug_nal_unit(h, nal, size);
+    
+    //check nal type
+    switch (h->nal->nal_unit_type)
+    {
+        case NAL_UNIT_TYPE_CODED_SLICE_IDR:
+        case NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
+        case NAL_UNIT_TYPE_CODED_SLICE_AUX:
+            printf("reference pps: %d & sps: %d\n", h->sh->pic_parameter_set_id,
+                   h->pps->seq_parameter_set_id);
+            
+            write_pps(ctx, ctx->outfile_base, h->sh->pic_parameter_set_id);
+            
+            //start saving the slices
+            write_nal(ctx->outfile_base, nal, size);
+            
+            break;
+            
+        case NAL_UNIT_TYPE_SPS:
+            write_nal(ctx->outfile_base, nal, size);
+            break;
+            
+        case NAL_UNIT_TYPE_PPS:
+            id = h->pps->pic_parameter_set_id;
+            if (id < 0 || id >= NUM_PPS_IDS) { write_nal(ctx->outfile_misc, nal, size); break; }
+
+            if (ctx->pps_buf[id] != NULL) { free(ctx->pps_buf[id]); }
+            ctx->pps_buf[id] = (uint8_t*)malloc(size);
+            memcpy(ctx->pps_buf[id], nal, size);
+            ctx->pps_buf_size[id] = size;
+            
+            break;
+            
+            //SVC support
+        case NAL_UNIT_TYPE_SUBSET_SPS:
+            id = h->sps_subset->sps->seq_parameter_set_id;
+            printf("sps_ext id: %d\n", id);
+            if (id < 0 || id >= NUM_SPS_SUBSET_IDS) { write_nal(ctx->outfile_misc, nal, size); break; }
+
+            // a repeated subset SPS goes on in the same file
+            if (ctx->outfile_layers[id] == NULL)
+            {
+                sprintf(fname_buf, "%s.l_%d", ctx->fname, id);
+                ctx->outfile_layers[id] = fopen(fname_buf, "wb");
+                if (ctx->outfile_layers[id] == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
+            }
+            
+            write_nal(ctx->outfile_layers[id], nal, size);
+            break;
+            
+            //SVC support
+        case NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION:            
+            printf("reference extension pps: %d & sps: %d\n", h->sh->pic_parameter_set_id,
+                   h->pps->seq_parameter_set_id);
+            
+            layer = layer_file(ctx, h->pps->seq_parameter_set_id);
+            if (layer == NULL) { write_nal(ctx->outfile_misc, nal, size); break; }
+
+            write_pps(ctx, layer, h->sh->pic_parameter_set_id);
+            
+            //start saving the slices
+            write_nal(layer, nal, size);
+            break;
+            
+        default:
+            write_nal(ctx->outfile_misc, nal, size);
+            break;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    svc_split_ctx_t ctx = {0};
+    ctx.h = h264_new();
+    ctx.fname = argv[1];
     
     FILE* infile = fopen(argv[1], "rb");
     if (infile == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
@@ -31,157 +160,36 @@ int main(int argc, char *argv[])
     
     //create base layer file
     sprintf(fname_buf, "%s.base", argv[1]);
-    FILE* outfile_base = fopen(fname_buf, "wb");
-    if (outfile_base == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
-    
-    //scalable layer
-    FILE* outfile_layers[32] = {0};
+    ctx.outfile_base = fopen(fname_buf, "wb");
+    if (ctx.outfile_base == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
     
     //misc packets file
     memset(fname_buf, 0, 1024);
     sprintf(fname_buf, "%s.misc", argv[1]);
-    FILE* outfile_misc = fopen(fname_buf, "wb");
-    if (outfile_misc == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
+    ctx.outfile_misc = fopen(fname_buf, "wb");
+    if (ctx.outfile_misc == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
     
 
     if (h264_dbgfile == NULL) { h264_dbgfile = stdout; }
     
-    size_t rsz = 0;
-    size_t sz = 0;
-    int64_t off = 0;
-    uint8_t* p = buf;
-    
-    int nal_start, nal_end;
+    // regular files are mapped, pipes are read in chunks
+    nal_splitter_t* splitter = nal_splitter_new(split_nal, &ctx);
+    if (nal_splitter_push_file(splitter, infile) < 0) { fprintf( stderr, "!! Error: read failed: %s \n", strerror(errno)); }
     
-    //this is to identify whether pps is written or not
-    char *pps_buf[32];
-    int pps_buf_size[32];
-    
-    while (1)
-    {
-        rsz = fread(buf + sz, 1, BUFSIZE - sz, infile);
-        if (rsz == 0)
-        {
-            if (ferror(infile)) { fprintf( stderr, "!! Error: read failed: %s \n", strerror(errno)); break; }
-            break;  // if (feof(infile))
-        }
-        
-        sz += rsz;
-        
-        while (find_nal_unit(p, sz, &nal_start, &nal_end) > 0)
-        {
-            fprintf( h264_dbgfile, "!! Found NAL at offset %lld (0x%04llX), size %lld (0x%04llX) \n",
-                        (long long int)(off + (p - buf) + nal_start),
-                        (long long int)(off + (p - buf) + nal_start),
-                        (long long int)(nal_end - nal_start),
-                        (long long int)(nal_end - nal_start) );
-            
-            fprintf( h264_dbgfile, "XX ");
-            debug_bytes(p, nal_end - nal_start >= 16 ? 16: nal_end - nal_start);
-            
-            p += nal_start;
-            read_debug_nal_unit(h, p, nal_end - nal_start);
-            
-            //check nal type
-            switch (h->nal->nal_unit_type)
-            {
-                case NAL_UNIT_TYPE_CODED_SLICE_IDR:
-                case NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
-                case NAL_UNIT_TYPE_CODED_SLICE_AUX:
-                    printf("reference pps: %d & sps: %d\n", h->sh->pic_parameter_set_id,
-                           h->pps_table[h->sh->pic_parameter_set_id]->seq_parameter_set_id);
-                    
-                    if (pps_buf[h->sh->pic_parameter_set_id] != NULL)
-                    {
-                        fwrite(pps_buf[h->sh->pic_parameter_set_id], 1, pps_buf_size[h->sh->pic_parameter_set_id], outfile_base);
-                        free(pps_buf[h->sh->pic_parameter_set_id]);
-                        pps_buf[h->sh->pic_parameter_set_id] = NULL;
-                    }
-                    
-                    //start saving the slices
-                    fwrite(p - nal_start, 1, nal_end, outfile_base);
-                    
-                    break;
-                    
-                case NAL_UNIT_TYPE_SPS:
-                    fwrite(p - nal_start, 1, nal_end, outfile_base);
-                    break;
-                    
-                case NAL_UNIT_TYPE_PPS:
-                    pps_buf[h->pps->pic_parameter_set_id] = malloc(nal_end);
-                    memcpy(pps_buf[h->pps->pic_parameter_set_id], p - nal_start, nal_end);
-                    pps_buf_size[h->pps->pic_parameter_set_id] = nal_end;
-                    
-                    break;
-                    
-                    //SVC support
-                case NAL_UNIT_TYPE_SUBSET_SPS:
-                    printf("sps_ext id: %d\n", h->sps_subset->sps->seq_parameter_set_id);
-                    memset(fname_buf, 0, 1024);
-                    sprintf(fname_buf, "%s.l_%d", argv[1], h->sps_subset->sps->seq_parameter_set_id);
-                    outfile_layers[h->sps_subset->sps->seq_parameter_set_id] = fopen(fname_buf, "wb");
-                    if (outfile_layers[h->sps_subset->sps->seq_parameter_set_id] == NULL) { fprintf( stderr, "!! Error: could not open file: %s \n", strerror(errno)); exit(EXIT_FAILURE); }
-                    
-                    fwrite(p - nal_start, 1, nal_end, outfile_layers[h->sps_subset->sps->seq_parameter_set_id]);
-                    break;
-                    
-                    //SVC support
-                case NAL_UNIT_TYPE_CODED_SLICE_SVC_EXTENSION:            
-                    printf("reference extension pps: %d & sps: %d\n", h->sh->pic_parameter_set_id,
-                           h->pps_table[h->sh->pic_parameter_set_id]->seq_parameter_set_id);
-                    
-                    if (pps_buf[h->sh->pic_parameter_set_id] != NULL)
-                    {
-                        fwrite(pps_buf[h->sh->pic_parameter_set_id], 1, pps_buf_size[h->sh->pic_parameter_set_id], outfile_layers[h->pps_table[h->sh->pic_parameter_set_id]->seq_parameter_set_id]);
-                        free(pps_buf[h->sh->pic_parameter_set_id]);
-                        pps_buf[h->sh->pic_parameter_set_id] = NULL;
-                    }
-                    
-                    //start saving the slices
-                    fwrite(p - nal_start, 1, nal_end, outfile_layers[h->pps_table[h->sh->pic_parameter_set_id]->seq_parameter_set_id]);
-                    break;
-                    
-                default:
-                    fwrite(p - nal_start, 1, nal_end, outfile_misc);
-                    break;
-            }
-            
-            //save nal to corresponding file
-            
-            //skip to next NAL
-            p += (nal_end - nal_start);
-            sz -= nal_end;
-            
-        }
-        
-        // if no NALs found in buffer, discard it
-        if (p == buf)
-        {
-            fprintf( stderr, "!! Did not find any NALs between offset %lld (0x%04llX), size %lld (0x%04llX), discarding \n",
-                    (long long int)off,
-                    (long long int)off,
-                    (long long int)off + sz,
-                    (long long int)off + sz);
-            
-            p = buf + sz;
-            sz = 0;
-        }
-        
-        memmove(buf, p, sz);
-        off += p - buf;
-        p = buf;
-    }
-    
-    h264_free(h);
-    free(buf);
+    nal_splitter_free(splitter);
+    h264_free(ctx.h);
     
     fclose(h264_dbgfile);
     fclose(infile);
-    fclose(outfile_base);
-    fclose(outfile_misc);
-    for(int i = 0; i < 32; i++) {
-        if (outfile_layers[i] != NULL)
-            fclose(outfile_layers[i]);
+    fclose(ctx.outfile_base);
+    fclose(ctx.outfile_misc);
+    for(int i = 0; i < NUM_SPS_SUBSET_IDS; i++) {
+        if (ctx.outfile_layers[i] != NULL)
+            fclose(ctx.outfile_layers[i]);
+    }
+    for(int i = 0; i < NUM_PPS_IDS; i++) {
+        if (ctx.pps_buf[i] != NULL)
+            free(ctx.pps_buf[i]);
     }
 
     return 0;
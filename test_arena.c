@@ -0,0 +1,125 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ Checks that reading a stream does not use the heap per NAL once h264_stream_t.arena has grown to fit its NALs.
+
+ Each .264 file given on the command line is read twice with read_nal_unit into the same stream.  malloc, calloc,
+ realloc and free are replaced by versions which count their calls, and the test fails if the second pass makes
+ any.  It is also built with HAVE_SEI, so that SEI NALs are parsed and counted too.
+ Exits with 77, for skipped, where the allocator cannot be replaced.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "h264_stream.h"
+
+#define EXIT_SKIP 77
+
+#ifdef __GLIBC__
+
+// the program's own definitions take the place of the C library's, in the library as well as here
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void __libc_free(void* p);
+
+static int counting = 0;
+static long num_heap_calls = 0;
+
+void* malloc(size_t size) { num_heap_calls += counting; return __libc_malloc(size); }
+void* calloc(size_t n, size_t size) { num_heap_calls += counting; return __libc_calloc(n, size); }
+void* realloc(void* p, size_t size) { num_heap_calls += counting; return __libc_realloc(p, size); }
+void free(void* p) { if (p != NULL) { num_heap_calls += counting; } __libc_free(p); }
+
+static uint8_t* read_file(const char* filename, int* size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { fprintf( stderr, "!! Error: could not open file %s: %s \n", filename, strerror(errno)); return NULL; }
+
+    int cap = 1024*1024;
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    size_t rsz;
+    *size = 0;
+    while ((rsz = fread(buf + *size, 1, cap - *size, f)) > 0)
+    {
+        *size += rsz;
+        if (*size == cap) { cap *= 2; buf = (uint8_t*)realloc(buf, cap); }
+    }
+    fclose(f);
+    return buf;
+}
+
+// read every NAL of buf into h; returns the number of heap calls made while reading them
+static long read_stream(h264_stream_t* h, uint8_t* buf, int size)
+{
+    uint8_t* p = buf;
+    int nal_start, nal_end;
+    long n = 0;
+
+    while (find_nal_unit(p, size - (int)(p - buf), &nal_start, &nal_end) > 0)
+    {
+        p += nal_start;
+        num_heap_calls = 0;
+        counting = 1;
+        read_nal_unit(h, p, nal_end - nal_start);
+        counting = 0;
+        n += num_heap_calls;
+        p += nal_end - nal_start;
+    }
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    int failed = 0;
+
+    if (argc < 2) { fprintf( stderr, "usage: test_arena file.264 ...\n" ); return EXIT_FAILURE; }
+
+    for (int i = 1; i < argc; i++)
+    {
+        int size;
+        uint8_t* buf = read_file(argv[i], &size);
+        if (buf == NULL) { return EXIT_FAILURE; }
+
+        h264_stream_t* h = h264_new();
+        long first = read_stream(h, buf, size);
+        long second = read_stream(h, buf, size);
+        h264_free(h);
+        free(buf);
+
+        printf("%s: %ld heap calls in the first pass, %ld in the second\n", argv[i], first, second);
+        if (second != 0) { failed = 1; }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else
+
+int main()
+{
+    printf("test_arena: skipped, the allocator cannot be replaced on this platform\n");
+    return EXIT_SKIP;
+}
+
+#endif
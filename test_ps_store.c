@@ -0,0 +1,233 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ Checks the parameter set store (h264_ps_store.h) on each .264 file given on the command line.
+
+ Two streams sharing a store read the file, and must end up with the same parameter sets as a stream of its own,
+ held once in the store.  Putting a changed SPS and PPS under an id must release the old ones when no stream uses
+ them any more, freeing the streams must empty the store, and a stream which has parameter sets must refuse a store.
+ With pthreads, several threads then read the files into streams sharing one store at the same time.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "h264_stream.h"
+#include "h264_ps_store.h"
+
+#define NUM_THREADS 8
+#define NUM_ROUNDS 20
+
+typedef struct
+{
+    const char* filename;
+    uint8_t* buf;
+    int size;
+    h264_stream_t* ref;     // the file read into a stream without a store
+} sample_t;
+
+static sample_t* samples;
+static int num_samples;
+static h264_ps_store_t* shared_store;
+static int failed = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("!! %s: ", sample->filename); printf(__VA_ARGS__); printf("\n"); failed = 1; } } while (0)
+
+static uint8_t* read_file(const char* filename, int* size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) { fprintf( stderr, "!! Error: could not open file %s: %s \n", filename, strerror(errno)); return NULL; }
+
+    int cap = 1024*1024;
+    uint8_t* buf = (uint8_t*)malloc(cap);
+    size_t rsz;
+    *size = 0;
+    while ((rsz = fread(buf + *size, 1, cap - *size, f)) > 0)
+    {
+        *size += rsz;
+        if (*size == cap) { cap *= 2; buf = (uint8_t*)realloc(buf, cap); }
+    }
+    fclose(f);
+    return buf;
+}
+
+// a stream which has read all of a sample, keeping its parameter sets in store if that is not NULL
+static h264_stream_t* read_sample(const sample_t* sample, h264_ps_store_t* store)
+{
+    h264_stream_t* h = h264_new();
+    uint8_t* p = sample->buf;
+    int nal_start, nal_end;
+
+    if (store != NULL && h264_set_ps_store(h, store) < 0) { h264_free(h); return NULL; }
+    while (find_nal_unit(p, sample->size - (int)(p - sample->buf), &nal_start, &nal_end) > 0)
+    {
+        p += nal_start;
+        read_nal_unit(h, p, nal_end - nal_start);
+        p += nal_end - nal_start;
+    }
+    return h;
+}
+
+// whether a stream has the same parameter sets as the reference stream of its sample
+static int same_ps(const sample_t* sample, h264_stream_t* h)
+{
+    for (int i = 0; i < 32; i++)
+    {
+        sps_t* a = sample->ref->sps_table[i];
+        sps_t* b = h->sps_table[i];
+        if ((a == NULL) != (b == NULL) || (a != NULL && memcmp(a, b, sizeof(sps_t)) != 0)) { return 0; }
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        pps_t* a = sample->ref->pps_table[i];
+        pps_t* b = h->pps_table[i];
+        if ((a == NULL) != (b == NULL) || (a != NULL && memcmp(a, b, sizeof(pps_t)) != 0)) { return 0; }
+    }
+    return 1;
+}
+
+static void test_sample(const sample_t* sample)
+{
+    h264_ps_store_t* store = h264_ps_store_new();
+    int num_ps = 0;
+    int sps_id = -1;
+    int pps_id = -1;
+
+    // each id holds a different parameter set, as the id is part of it
+    for (int i = 0; i < 32; i++) { if (sample->ref->sps_table[i] != NULL) { num_ps++; sps_id = i; } }
+    for (int i = 0; i < 256; i++) { if (sample->ref->pps_table[i] != NULL) { num_ps++; pps_id = i; } }
+
+    h264_stream_t* a = read_sample(sample, store);
+    h264_stream_t* b = read_sample(sample, store);
+    CHECK(a != NULL && b != NULL, "h264_set_ps_store failed on a new stream");
+    if (a == NULL || b == NULL) { return; }
+
+    CHECK(same_ps(sample, a) && same_ps(sample, b), "parameter sets differ from those of a stream without a store");
+    CHECK(h264_ps_store_size(store) == num_ps, "%d parameter sets in the store for two streams, expected %d", h264_ps_store_size(store), num_ps);
+    if (sps_id >= 0) { CHECK(a->sps_table[sps_id] == b->sps_table[sps_id], "the streams do not share SPS %d", sps_id); }
+    if (pps_id >= 0) { CHECK(a->pps_table[pps_id] == b->pps_table[pps_id], "the streams do not share PPS %d", pps_id); }
+
+    CHECK(h264_set_ps_store(a, store) < 0, "h264_set_ps_store accepted a stream which has parameter sets");
+
+    // a changed SPS and PPS under the same ids: the old ones stay while b uses them, and go once neither stream does
+    if (sps_id >= 0 && pps_id >= 0)
+    {
+        sps_t sps = *a->sps_table[sps_id];
+        pps_t pps = *a->pps_table[pps_id];
+        sps.level_idc++;
+        pps.pic_init_qp_minus26++;
+
+        h264_sps_table_put(a, &sps);
+        h264_pps_table_put(a, &pps);
+        CHECK(h264_ps_store_size(store) == num_ps + 2, "%d parameter sets after replacing some in one stream, expected %d", h264_ps_store_size(store), num_ps + 2);
+
+        h264_sps_table_put(b, &sps);
+        h264_pps_table_put(b, &pps);
+        CHECK(h264_ps_store_size(store) == num_ps, "%d parameter sets after replacing them in both streams, expected %d", h264_ps_store_size(store), num_ps);
+        CHECK(a->sps_table[sps_id] == b->sps_table[sps_id] && a->pps_table[pps_id] == b->pps_table[pps_id], "the streams do not share the replaced parameter sets");
+    }
+
+    h264_free(a);
+    CHECK(h264_ps_store_size(store) == num_ps, "%d parameter sets after freeing one stream, expected %d", h264_ps_store_size(store), num_ps);
+    h264_free(b);
+    CHECK(h264_ps_store_size(store) == 0, "%d parameter sets after freeing both streams, expected none", h264_ps_store_size(store));
+
+    h264_ps_store_free(store);
+}
+
+#ifdef HAVE_LIBPTHREAD
+// returns non-NULL if it failed
+static void* read_samples(void* arg)
+{
+    long n = (long)arg;
+    void* rc = NULL;
+
+    for (int r = 0; r < NUM_ROUNDS; r++)
+    {
+        const sample_t* sample = &samples[(n + r) % num_samples];
+        h264_stream_t* h = read_sample(sample, shared_store);
+        if (h == NULL || !same_ps(sample, h))
+        {
+            printf("!! %s: parameter sets differ when read by several threads\n", sample->filename);
+            rc = (void*)sample;
+        }
+        if (h != NULL) { h264_free(h); }
+    }
+    return rc;
+}
+
+static void test_threads()
+{
+    pthread_t threads[NUM_THREADS];
+    int started[NUM_THREADS];
+
+    shared_store = h264_ps_store_new();
+    for (long i = 0; i < NUM_THREADS; i++) { started[i] = (pthread_create(&threads[i], NULL, read_samples, (void*)i) == 0); }
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        void* rc = NULL;
+        if (started[i]) { pthread_join(threads[i], &rc); }
+        if (rc != NULL) { failed = 1; }
+    }
+
+    if (h264_ps_store_size(shared_store) != 0)
+    {
+        printf("!! %d parameter sets left in the store after %d threads\n", h264_ps_store_size(shared_store), NUM_THREADS);
+        failed = 1;
+    }
+    h264_ps_store_free(shared_store);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) { fprintf( stderr, "usage: test_ps_store file.264 ...\n" ); return EXIT_FAILURE; }
+
+    num_samples = argc - 1;
+    samples = (sample_t*)calloc(num_samples, sizeof(sample_t));
+    for (int i = 0; i < num_samples; i++)
+    {
+        samples[i].filename = argv[i + 1];
+        samples[i].buf = read_file(argv[i + 1], &samples[i].size);
+        if (samples[i].buf == NULL) { return EXIT_FAILURE; }
+        samples[i].ref = read_sample(&samples[i], NULL);
+    }
+
+    for (int i = 0; i < num_samples; i++) { test_sample(&samples[i]); }
+#ifdef HAVE_LIBPTHREAD
+    test_threads();
+#endif
+
+    for (int i = 0; i < num_samples; i++)
+    {
+        h264_free(samples[i].ref);
+        free(samples[i].buf);
+    }
+    free(samples);
+
+    printf("test_ps_store: %s\n", failed ? "failed" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}